@@ -0,0 +1,49 @@
+#ifndef SRC_DECODE_CACHE_H
+#define SRC_DECODE_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "riscv.h"
+
+// direct-mapped cache of predecoded instructions indexed by pc
+class DecodeCache {
+  static constexpr uint32_t ENTRY_NUM = 1 << 14;
+
+  struct Entry {
+    uint64_t pc = 1;  // odd pc is never fetched, marks an empty entry
+    uint32_t inst = 0;
+    RISCV::DecodedInst decoded;
+  };
+  std::vector<Entry> entries_;
+
+  static uint32_t Index(uint64_t pc) { return (pc >> 2) & (ENTRY_NUM - 1); }
+
+ public:
+  DecodeCache() : entries_(ENTRY_NUM) {}
+
+  // the fetched word is part of the tag, so an op fetched before a store to
+  // its pc still decodes the word it actually fetched
+  const RISCV::DecodedInst& Lookup(uint64_t pc, uint32_t inst) {
+    Entry& entry = entries_[Index(pc)];
+    if (entry.pc != pc || entry.inst != inst) {
+      // throws on illegal instruction, leaving the entry untouched
+      entry.decoded = RISCV::PredecodeInst(inst);
+      entry.pc = pc;
+      entry.inst = inst;
+    }
+    return entry.decoded;
+  }
+
+  // drop instructions overlapping a store to [addr, addr + len)
+  void Invalidate(uint64_t addr, uint32_t len) {
+    for (uint64_t pc = addr & ~3ULL; pc < addr + len; pc += 4) {
+      Entry& entry = entries_[Index(pc)];
+      if (entry.pc == pc) {
+        entry.pc = 1;
+      }
+    }
+  }
+};
+
+#endif
@@ -18,7 +18,9 @@
 
 using namespace RISCV;
 
-FiveStageSimulator::FiveStageSimulator(const Options& opts) : Simulator(opts) {
+template <typename Policy>
+FiveStageSimulator<Policy>::FiveStageSimulator(const Options& opts)
+    : Simulator(opts) {
   if (opts.branch_predictor == "at") {
     predictor_ = std::make_unique<AlwaysTakenPredictor>();
   } else if (opts.branch_predictor == "1bit") {
@@ -35,7 +37,10 @@ FiveStageSimulator::FiveStageSimulator(const Options& opts) : Simulator(opts) {
   history_.data_hazard_count = 0;
 }
 
-void FiveStageSimulator::Run() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Run() {
+  history_.reg_base = regs_;
+
   // Main Simulation Loop
   while (true) {
     if (regs_[0] != 0) {
@@ -47,7 +52,7 @@ void FiveStageSimulator::Run() {
 
     // handle branch recoveries (mispredictions or predicted-taken)
     if (should_recover_branch_) {
-      if (verbose_)
+      if (Verbose())
         printf("branch recovery: new pc 0x%08lx\n", branch_next_pc_);
 
       pc_ = branch_next_pc_;
@@ -71,17 +76,13 @@ void FiveStageSimulator::Run() {
     Fetch();
 
     history_.cycle_count++;
-    history_.reg_record.push_back(GetRegInfoStr());
-    if (history_.reg_record.size() >= 100000) {  // Avoid using up memory
-      history_.reg_record.clear();
-      history_.inst_record.clear();
-    }
+    RecordCycle();
 
-    if (verbose_) {
-      std::cout << GetRegInfoStr();
+    if (Verbose()) {
+      std::cout << GetRegInfoStr(pc_, regs_);
     }
 
-    if (single_step_) {
+    if (SingleStep()) {
       // printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
       char ch;
       while ((ch = getchar()) != '\n') {
@@ -93,14 +94,15 @@ void FiveStageSimulator::Run() {
   }
 }
 
-void FiveStageSimulator::Fetch() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Fetch() {
   if (true == wait_for_branch_) {
    return;
   }
 
   /* if pipeline is stalled (our output slot is not empty), return */
   if (decode_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Fetch: stalled at fetch\n");
     }
     return;
@@ -111,55 +113,56 @@ void FiveStageSimulator::Fetch() {
   }
 
   /* Allocate an op and send it down the pipeline. */
-  auto op = std::make_unique<PipeOp>();
+  auto* op = AllocOp();
   op->inst = memory_->GetInt(pc_);
-  if (verbose_) {
+  if (Verbose()) {
     printf("Fetched instruction 0x%.8x at address 0x%lx\n", op->inst, pc_);
   }
   op->pc = pc_;
-  decode_op_ = std::move(op);
+  decode_op_ = op;
 
   pc_ += 4;
 }
 
-void FiveStageSimulator::Decode() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Decode() {
   /* if no op to decode, return */
   if (decode_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Decode: Bubble\n");
     }
     return;
   }
 
-  auto* op = decode_op_.get();
+  auto* op = decode_op_;
   if (op->pc_len != 4) {
     Panic(
         "Current implementation does not support 16bit RV64C instructions!\n");
   }
   try {
-    DecodeInst(op, regs_);
+    const DecodedInst& decoded = decode_cache_.Lookup(op->pc, op->inst);
+    DecodeInst(op, decoded, regs_);
   } catch (const std::exception& e) {
     Panic(e.what());
   }
 
-  history_.inst_record.emplace_back(
-      std::format("{:#010x}: {}\n", op->pc, op->inst_str));
+  history_.inst_record.Push({op->pc, op->inst, history_.reg_record.Pushed()});
 
   /* if downstream stall or occur data hazard, return
    * (and leave any input we had)
    */
   if (execute_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       std::cout << std::format(
           "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-          op->pc, op->inst_str);
+          op->pc, DisassembleInst(op->inst));
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   // data hazard detect at last to show inststr
@@ -171,7 +174,7 @@ void FiveStageSimulator::Decode() {
             rs == data_hazard_mem_op_dest_ || rs == data_hazard_wb_op_dest_);
   };
   if (wait_for_data(op->rs1) || wait_for_data(op->rs2)) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("\tstalled at decode for data hazard\n");
     }
     // debug information
@@ -183,7 +186,7 @@ void FiveStageSimulator::Decode() {
   if (IsBranch(op->inst_type)) {
     op->predicted_taken = predictor_->Predict(op->pc);
 
-    if (verbose_) {
+    if (Verbose()) {
       printf("  Branch prediction: %s (%s)\n",
              op->predicted_taken ? "taken" : "not taken",
              predictor_name_.c_str());
@@ -194,7 +197,7 @@ void FiveStageSimulator::Decode() {
       wait_for_branch_ = true;
       
       PipeRecover(op->pc + op->offset);
-      if (verbose_) {
+      if (Verbose()) {
         printf("Fetch: Bubble due to control hazard\n");
       }
     }
@@ -204,31 +207,32 @@ void FiveStageSimulator::Decode() {
   }
 
   /* place op in downstream slot */
-  execute_op_ = std::move(decode_op_);
+  execute_op_ = decode_op_;
   decode_op_ = nullptr;
 }
 
-void FiveStageSimulator::Execute() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Execute() {
   /* if no op to execute, return */
   if (execute_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Execute: Bubble\n");
     }
     return;
   }
-  auto* op = execute_op_.get();
+  auto* op = execute_op_;
 
   /* if downstream stall, return (and leave any input we had) */
   if (mem_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Execute: Stall\n");
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Execute instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
   history_.inst_count++;
 
@@ -266,24 +270,24 @@ void FiveStageSimulator::Execute() {
 
       uint64_t correct_pc = actual_taken ? actual_target_pc : sequential_pc;
       PipeRecover(correct_pc);
-      decode_op_.reset();
+      ReleaseOp(decode_op_);
 
       wait_for_branch_ = true; 
 
-      if (verbose_) {
+      if (Verbose()) {
         printf("  Branch prediction result: mispredicted\n");
         printf("Decode: Bubble due to control hazard\n");
         printf("Fetch: Bubble due to control hazard\n");
       }
     } else {
-      if (verbose_) {
+      if (Verbose()) {
         printf("  Branch prediction result: correct\n");
       }
     }
 
   } else if (IsJump(op->inst_type)) {
     PipeRecover(actual_target_pc);
-    decode_op_.reset();
+    ReleaseOp(decode_op_);
   }
   // --- Lab 4 结束 ---
 
@@ -292,20 +296,21 @@ void FiveStageSimulator::Execute() {
   data_hazard_execute_op_dest_ = op->dest_reg;
 
   /* remove from upstream stage and place in downstream stage */
-  mem_op_ = std::move(execute_op_);
+  mem_op_ = execute_op_;
   execute_op_ = nullptr;
 }
 
-void FiveStageSimulator::MemoryAccess() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::MemoryAccess() {
   /* if there is no instruction in this pipeline stage, we are done */
   if (!mem_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Memory Access: Bubble\n");
     }
     return;
   }
 
-  PipeOp* op = mem_op_.get();
+  PipeOp* op = mem_op_;
 
   const int64_t& op2 = op->op2;
   const RegId& dest_reg = op->dest_reg;
@@ -315,10 +320,10 @@ void FiveStageSimulator::MemoryAccess() {
   const bool read_sign_ext = op->read_sign_ext;
   const uint32_t mem_len = op->mem_len;
 
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "MemoryAccess instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   data_hazard_mem_op_dest_ = dest_reg;
@@ -340,6 +345,8 @@ void FiveStageSimulator::MemoryAccess() {
       default:
         Panic("Unknown memLen %d\n", mem_len);
     }
+    // self-modifying code must not hit stale decodes
+    decode_cache_.Invalidate(out, mem_len);
    }
   
 
@@ -382,14 +389,15 @@ void FiveStageSimulator::MemoryAccess() {
   data_hazard_mem_op_dest_ = dest_reg;
 
   /* clear stage input and transfer to next stage */
-  wb_op_ = std::move(mem_op_);
+  wb_op_ = mem_op_;
   mem_op_ = nullptr;
 }
 
-void FiveStageSimulator::WriteBack() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::WriteBack() {
   /* if there is no instruction in this pipeline stage, we are done */
   if (!wb_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("WriteBack: Bubble\n");
     }
     return;
@@ -397,11 +405,11 @@ void FiveStageSimulator::WriteBack() {
   // no situation to stall
 
   /* grab the op out of our input slot */
-  PipeOp* op = wb_op_.get();
-  if (verbose_) {
+  PipeOp* op = wb_op_;
+  if (Verbose()) {
     std::cout << std::format(
         "WriteBack instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   /* if this instruction writes a register, do so now */
@@ -409,17 +417,35 @@ void FiveStageSimulator::WriteBack() {
   const RegId& dest_reg = op->dest_reg;
   if (dest_reg > 0) {
     regs_[dest_reg] = op->out;
+    history_.wb_reg = dest_reg;
+    history_.wb_value = op->out;
   }
 
   // data hazard for decode to detect
   data_hazard_wb_op_dest_ = dest_reg;
 
-  /* free the op automatically with unique_ptr */
-  wb_op_.reset();
-  wb_op_ = nullptr;
+  /* return the op to the pool */
+  ReleaseOp(wb_op_);
+}
+
+template <typename Policy>
+PipeOp* FiveStageSimulator<Policy>::AllocOp() {
+  assert(free_op_num_ > 0);
+  auto* op = free_ops_[--free_op_num_];
+  *op = PipeOp{};
+  return op;
+}
+
+template <typename Policy>
+void FiveStageSimulator<Policy>::ReleaseOp(PipeOp*& op) {
+  if (op != nullptr) {
+    free_ops_[free_op_num_++] = op;
+    op = nullptr;
+  }
 }
 
-void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
+template <typename Policy>
+void FiveStageSimulator<Policy>::PipeRecover(uint32_t dest_pc) {
   /* if there is already a recovery scheduled, it must have come from a later
    * stage (which executes older instructions), hence that recovery overrides
    * our recovery. Simply return in this case. */
@@ -430,7 +456,8 @@ void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
   branch_next_pc_ = dest_pc;
 }
 
-void FiveStageSimulator::PrintStatistics() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::PrintStatistics() const {
   printf("------------ STATISTICS -----------\n");
   printf("Number of Instructions: %u\n", history_.inst_count);
   printf("Number of Cycles: %u\n", history_.cycle_count);
@@ -446,14 +473,31 @@ void FiveStageSimulator::PrintStatistics() const {
   printf("Branch Prediction Accuracy: %.4f (%s)\n", accuracy,
          predictor_name_.c_str());
 
+  printf("Resident Memory: %lu KB\n", memory_->ResidentSize() / 1024);
   printf("-----------------------------------\n");
 }
 
-std::string FiveStageSimulator::GetRegInfoStr() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::RecordCycle() {
+  auto& reg_record = history_.reg_record;
+  if (reg_record.Size() == reg_record.Capacity()) {
+    // fold the record about to be overwritten into the base state
+    const auto& oldest = reg_record[0];
+    if (oldest.reg > 0) {
+      history_.reg_base[oldest.reg] = oldest.value;
+    }
+  }
+  reg_record.Push({pc_, history_.wb_value, history_.wb_reg});
+  history_.wb_reg = -1;
+}
+
+template <typename Policy>
+std::string FiveStageSimulator<Policy>::GetRegInfoStr(uint64_t pc,
+                                              const Regs& regs) const {
   std::string str = "------------ CPU STATE ------------\n";
-  str += std::format("PC: {:#x}\n", pc_);
+  str += std::format("PC: {:#x}\n", pc);
   for (uint32_t i = 0; i < 32; ++i) {
-    str += std::format("{}: {:#018x}({}) ", REGNAME[i], regs_[i], regs_[i]);
+    str += std::format("{}: {:#018x}({}) ", REGNAME[i], regs[i], regs[i]);
     if (i % 4 == 3) {
       str += "\n";
     }
@@ -462,17 +506,50 @@ std::string FiveStageSimulator::GetRegInfoStr() const {
   return str;
 }
 
-void FiveStageSimulator::DumpHistory() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::DumpHistory() const {
   std::ofstream ofile("dump.txt");
   ofile << "================== Excecution History =================="
         << std::endl;
-  for (uint32_t i = 0; i < history_.inst_record.size(); ++i) {
-    ofile << history_.inst_record[i];
-    ofile << history_.reg_record[i];
+
+  const auto& inst_record = history_.inst_record;
+  const auto& reg_record = history_.reg_record;
+  auto dump_inst = [&](uint64_t i) {
+    ofile << std::format("{:#010x}: {}\n", inst_record[i].pc,
+                         DisassembleInst(inst_record[i].inst));
+  };
+
+  // each instruction is dumped with the CPU state after the cycle it is
+  // decoded in, rebuilt by replaying register writes from reg_base
+  Regs regs = history_.reg_base;
+  uint64_t first_cycle = reg_record.Pushed() - reg_record.Size();
+  uint64_t i = 0;
+  while (i < inst_record.Size() && inst_record[i].cycle < first_cycle) {
+    ++i;
+  }
+  for (uint64_t c = 0; c < reg_record.Size(); ++c) {
+    const auto& record = reg_record[c];
+    if (record.reg > 0) {
+      regs[record.reg] = record.value;
+    }
+    for (; i < inst_record.Size() && inst_record[i].cycle == first_cycle + c;
+         ++i) {
+      dump_inst(i);
+      ofile << GetRegInfoStr(record.pc, regs);
+    }
+  }
+  // instructions of the unfinished cycle, e.g. when panicking
+  for (; i < inst_record.Size(); ++i) {
+    dump_inst(i);
+    ofile << GetRegInfoStr(pc_, regs_);
   }
   ofile << "========================================================"
         << std::endl;
   ofile << std::endl;
 
   ofile.close();
-}
\ No newline at end of file
+}
+
+// the only two instantiations, selected in Simulator::Create
+template class FiveStageSimulator<DebugTrace>;
+template class FiveStageSimulator<NoTrace>;
@@ -1,6 +1,7 @@
 #ifndef SRC_FIVE_STAGE_SIMULATOR_
 #define SRC_FIVE_STAGE_SIMULATOR_
 
+#include <array>
 #include <memory>
 #include <string>
 #include <utility>
@@ -8,9 +9,20 @@
 
 #include "options.h"
 #include "riscv.h"
+#include "ring_buffer.h"
 #include "simulator.h"
 #include "branch_predictor.h"
 
+// tracing policies, verbose output and single stepping are compiled
+// into the DebugTrace instantiation only
+struct DebugTrace {
+  static constexpr bool ENABLED = true;
+};
+struct NoTrace {
+  static constexpr bool ENABLED = false;
+};
+
+template <typename Policy>
 class FiveStageSimulator final : public Simulator {
   // control hazard
   // wait_for_branch_ is signal for fetch stage to stall,
@@ -27,7 +39,14 @@ class FiveStageSimulator final : public Simulator {
   RISCV::RegId data_hazard_mem_op_dest_ = -1;
   RISCV::RegId data_hazard_wb_op_dest_ = -1;
 
-  std::unique_ptr<RISCV::PipeOp> decode_op_, execute_op_, mem_op_, wb_op_;
+  // pipeline latches point into op_pool_, at most 4 ops are in flight
+  // so ops are recycled through free_ops_ instead of allocated per fetch
+  std::array<RISCV::PipeOp, 4> op_pool_{};
+  std::array<RISCV::PipeOp*, 4> free_ops_{&op_pool_[0], &op_pool_[1],
+                                          &op_pool_[2], &op_pool_[3]};
+  size_t free_op_num_ = 4;
+  RISCV::PipeOp *decode_op_ = nullptr, *execute_op_ = nullptr;
+  RISCV::PipeOp *mem_op_ = nullptr, *wb_op_ = nullptr;
 
   std::unique_ptr<BranchPredictor> predictor_;
   uint32_t branch_count_ = 0;
@@ -41,20 +60,49 @@ class FiveStageSimulator final : public Simulator {
     uint32_t data_hazard_count = 0;
     uint32_t control_hazard_count = 0;
 
-    std::vector<std::string> inst_record{};
-    std::vector<std::string> reg_record{};
+    // raw instructions, disassembled only when dumped
+    struct InstRecord {
+      uint64_t pc;
+      uint32_t inst;
+      uint64_t cycle;  // cycle in which the instruction is decoded
+    };
+    RingBuffer<InstRecord> inst_record{1 << 17};
+
+    // register write of every cycle, CPU states are rebuilt from
+    // reg_base only when dumped
+    struct RegRecord {
+      uint64_t pc;  // pc at the end of the cycle
+      uint64_t value;
+      RISCV::RegId reg;  // -1 if nothing is written back
+    };
+    RingBuffer<RegRecord> reg_record{1 << 17};
+    // register file before the oldest retained cycle
+    RISCV::Regs reg_base{};
+    // write back of the current cycle
+    RISCV::RegId wb_reg = -1;
+    uint64_t wb_value = 0;
   } history_;
 
+  bool Verbose() const { return Policy::ENABLED && verbose_; }
+  bool SingleStep() const { return Policy::ENABLED && single_step_; }
+
   void Fetch();
   void Decode();
   void Execute();
   void MemoryAccess();
   void WriteBack();
 
+  // take a cleared op from the pool / return a latched op to it
+  RISCV::PipeOp* AllocOp();
+  void ReleaseOp(RISCV::PipeOp*& op);
+
   // record jump pc and update pc next cycle
   void PipeRecover(uint32_t dest_pc);
 
-  std::string GetRegInfoStr() const;
+  // append the current cycle to the history
+  void RecordCycle();
+
+  std::string GetRegInfoStr(uint64_t pc, const RISCV::Regs& regs) const;
   void DumpHistory() const override;
   void PrintStatistics() const;
 
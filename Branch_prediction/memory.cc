@@ -1,22 +1,67 @@
 #include "memory.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <format>
 #include <stdexcept>
 
 void Memory::CheckAddr(uint32_t addr, std::size_t len) const {
-  if (addr + len >= arena_.size()) {
+  if (addr + len >= size_) {
     throw std::runtime_error(std::format(
         "Invalid memory access to addr {:x} for len {}\n", addr, len));
   };
 }
 
+uint8_t* Memory::GetPage(uint64_t page) {
+  auto& bytes = pages_[page];
+  if (!bytes) {
+    bytes = std::make_unique<uint8_t[]>(PAGE_SIZE);
+    resident_pages_++;
+  }
+  return bytes.get();
+}
+
 void Memory::ReadSpan(uint32_t addr, std::span<uint8_t> out) {
   CheckAddr(addr, out.size());
-  std::memcpy(out.data(), arena_.data() + addr, out.size());
+  // split at page boundaries
+  while (!out.empty()) {
+    uint32_t offset = addr & (PAGE_SIZE - 1);
+    std::size_t len = std::min<std::size_t>(out.size(), PAGE_SIZE - offset);
+    const uint8_t* page = FindPage(addr >> PAGE_SHIFT);
+    if (page != nullptr) {
+      std::memcpy(out.data(), page + offset, len);
+    } else {
+      std::memset(out.data(), 0, len);
+    }
+    addr += len;
+    out = out.subspan(len);
+  }
 }
 
 void Memory::WriteSpan(uint32_t addr, std::span<const uint8_t> in) {
   CheckAddr(addr, in.size());
-  std::memcpy(arena_.data() + addr, in.data(), in.size());
+  while (!in.empty()) {
+    uint32_t offset = addr & (PAGE_SIZE - 1);
+    std::size_t len = std::min<std::size_t>(in.size(), PAGE_SIZE - offset);
+    std::memcpy(GetPage(addr >> PAGE_SHIFT) + offset, in.data(), len);
+    addr += len;
+    in = in.subspan(len);
+  }
+}
+
+void Memory::Zero(uint32_t addr, std::size_t len) {
+  CheckAddr(addr, len);
+  while (len > 0) {
+    uint32_t offset = addr & (PAGE_SIZE - 1);
+    std::size_t chunk = std::min<std::size_t>(len, PAGE_SIZE - offset);
+    auto& page = pages_[addr >> PAGE_SHIFT];
+    if (page && chunk == PAGE_SIZE) {
+      page.reset();
+      resident_pages_--;
+    } else if (page) {
+      std::memset(page.get() + offset, 0, chunk);
+    }
+    addr += chunk;
+    len -= chunk;
+  }
 }
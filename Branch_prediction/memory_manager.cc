@@ -4,50 +4,34 @@
 
 MemoryManager::MemoryManager(const Options& opts) {
   auto mem = std::make_unique<Memory>(opts.memory_size);
+  memory_ = mem.get();
   backend_ = std::move(mem);
 }
 
 void MemoryManager::CopyFrom(const void* src, uint32_t dest, uint32_t len) {
   std::span<const uint8_t> data(reinterpret_cast<const uint8_t*>(src), len);
-  backend_->WriteSpan(dest, data);
+  static_cast<ByteAddressable*>(memory_)->WriteSpan(dest, data);
 }
 
-void MemoryManager::SetByte(uint32_t addr, uint8_t val) {
-  backend_->Write(addr, val);
+void MemoryManager::Zero(uint32_t dest, uint32_t len) {
+  // pages may be released
+  TlbFlush();
+  memory_->Zero(dest, len);
 }
 
-void MemoryManager::SetShort(uint32_t addr, uint16_t val) {
-  backend_->Write(addr, val);
+uint8_t* MemoryManager::TlbFill(uint64_t page, bool write) const {
+  // pages reaching the end of memory are left to its range check
+  if ((page + 1) << Memory::PAGE_SHIFT >= memory_->Size()) {
+    return nullptr;
+  }
+  uint8_t* host = write ? memory_->GetPage(page)
+                        : const_cast<uint8_t*>(memory_->FindPage(page));
+  if (host != nullptr) {
+    tlb_[page % TLB_NUM] = {page, host};
+  }
+  return host;
 }
 
-void MemoryManager::SetInt(uint32_t addr, uint32_t val) {
-  backend_->Write(addr, val);
-}
-
-void MemoryManager::SetLong(uint32_t addr, uint64_t val) {
-  backend_->Write(addr, val);
-}
-
-uint8_t MemoryManager::GetByte(uint32_t addr) const {
-  uint8_t value{};
-  backend_->Read(addr, value);
-  return value;
-}
+void MemoryManager::TlbFlush() { tlb_.fill(TlbEntry{}); }
 
-uint16_t MemoryManager::GetShort(uint32_t addr) const {
-  uint16_t value{};
-  backend_->Read(addr, value);
-  return value;
-}
-
-uint32_t MemoryManager::GetInt(uint32_t addr) const {
-  uint32_t value{};
-  backend_->Read(addr, value);
-  return value;
-}
-
-uint64_t MemoryManager::GetLong(uint32_t addr) const {
-  uint64_t value{};
-  backend_->Read(addr, value);
-  return value;
-}
+uint64_t MemoryManager::ResidentSize() const { return memory_->ResidentSize(); }
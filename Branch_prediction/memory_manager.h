@@ -1,29 +1,86 @@
 #ifndef SRC_MEMORY_MANAGER_H
 #define SRC_MEMORY_MANAGER_H
 
+#include <array>
+#include <cstring>
 #include <memory>
 
 #include "byte_addressable.h"
+#include "memory.h"
 #include "options.h"
 
 // adaptor of byte addressable `backend_` as an interface for simulator
 class MemoryManager {
   std::unique_ptr<ByteAddressable> backend_;
+  // main memory behind `backend_`, owned by it
+  Memory* memory_ = nullptr;
+
+  // software TLB, host pointers to recently used guest pages. accesses
+  // that miss it or cross a page take `backend_`
+  static constexpr uint32_t TLB_NUM = 256;
+  struct TlbEntry {
+    uint64_t page = UINT64_MAX;
+    uint8_t* host = nullptr;
+  };
+  mutable std::array<TlbEntry, TLB_NUM> tlb_{};
+
+  // reads never allocate, so pages not yet written stay out of the TLB
+  uint8_t* Translate(uint32_t addr, uint32_t len, bool write) const {
+    uint32_t offset = addr & (Memory::PAGE_SIZE - 1);
+    if (offset + len > Memory::PAGE_SIZE) {
+      return nullptr;
+    }
+    uint64_t page = addr >> Memory::PAGE_SHIFT;
+    const TlbEntry& entry = tlb_[page % TLB_NUM];
+    if (entry.page == page) {
+      return entry.host + offset;
+    }
+    uint8_t* host = TlbFill(page, write);
+    return host != nullptr ? host + offset : nullptr;
+  }
+  uint8_t* TlbFill(uint64_t page, bool write) const;
+  void TlbFlush();
+
+  template <typename T>
+  T Load(uint32_t addr) const {
+    T value{};
+    if (const uint8_t* host = Translate(addr, sizeof(T), false)) {
+      std::memcpy(&value, host, sizeof(T));
+    } else {
+      backend_->Read(addr, value);
+    }
+    return value;
+  }
+
+  template <typename T>
+  void Store(uint32_t addr, T value) {
+    if (uint8_t* host = Translate(addr, sizeof(T), true)) {
+      std::memcpy(host, &value, sizeof(T));
+    } else {
+      backend_->Write(addr, value);
+    }
+  }
 
  public:
   explicit MemoryManager(const Options& opts);
 
+  // bulk load of an image straight into memory, not seen by any cache
   void CopyFrom(const void* src, uint32_t dest, uint32_t len);
+  // bulk clear, likewise bypassing any cache
+  void Zero(uint32_t dest, uint32_t len);
+
+  void SetByte(uint32_t addr, uint8_t val) { Store(addr, val); }
+  void SetShort(uint32_t addr, uint16_t val) { Store(addr, val); }
+  void SetInt(uint32_t addr, uint32_t val) { Store(addr, val); }
+  void SetLong(uint32_t addr, uint64_t val) { Store(addr, val); }
 
-  void SetByte(uint32_t addr, uint8_t val);
-  void SetShort(uint32_t addr, uint16_t val);
-  void SetInt(uint32_t addr, uint32_t val);
-  void SetLong(uint32_t addr, uint64_t val);
+  uint8_t GetByte(uint32_t addr) const { return Load<uint8_t>(addr); }
+  uint16_t GetShort(uint32_t addr) const { return Load<uint16_t>(addr); }
+  uint32_t GetInt(uint32_t addr) const { return Load<uint32_t>(addr); }
+  uint64_t GetLong(uint32_t addr) const { return Load<uint64_t>(addr); }
 
-  uint8_t GetByte(uint32_t addr) const;
-  uint16_t GetShort(uint32_t addr) const;
-  uint32_t GetInt(uint32_t addr) const;
-  uint64_t GetLong(uint32_t addr) const;
+  // bytes of guest memory actually allocated
+  uint64_t ResidentSize() const;
 };
 
 #endif
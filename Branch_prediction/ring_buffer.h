@@ -0,0 +1,38 @@
+#ifndef SRC_RING_BUFFER_H
+#define SRC_RING_BUFFER_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// fixed-capacity buffer keeping the latest `capacity` records,
+// storage is allocated once so pushing never touches the heap
+template <typename T>
+class RingBuffer {
+  std::vector<T> buf_;
+  uint64_t mask_;
+  uint64_t pushed_ = 0;
+
+ public:
+  // capacity must be a power of 2
+  explicit RingBuffer(uint64_t capacity) : buf_(capacity), mask_(capacity - 1) {
+    assert(capacity > 0 && (capacity & mask_) == 0);
+  }
+
+  void Push(const T& record) { buf_[pushed_++ & mask_] = record; }
+  void Clear() { pushed_ = 0; }
+
+  uint64_t Capacity() const { return buf_.size(); }
+  // number of records retained
+  uint64_t Size() const { return std::min<uint64_t>(pushed_, buf_.size()); }
+  // number of records ever pushed
+  uint64_t Pushed() const { return pushed_; }
+
+  // the i-th oldest retained record
+  const T& operator[](uint64_t i) const {
+    return buf_[(pushed_ - Size() + i) & mask_];
+  }
+};
+
+#endif
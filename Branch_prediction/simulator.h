@@ -4,6 +4,7 @@
 #include <array>
 #include <memory>
 
+#include "decode_cache.h"
 #include "memory_manager.h"
 #include "options.h"
 #include "riscv.h"
@@ -15,6 +16,7 @@ class Simulator {
   uint32_t stack_base_ = 0;
   uint32_t stack_size_ = 0;
   std::unique_ptr<MemoryManager> memory_ = nullptr;
+  DecodeCache decode_cache_;
 
   bool single_step_ = false;
   bool verbose_ = false;
@@ -36,6 +38,7 @@ class Simulator {
 };
 
 // forward declaration
+template <typename Policy>
 class FiveStageSimulator;
 
 #endif
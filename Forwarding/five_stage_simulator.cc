@@ -17,7 +17,10 @@
 
 using namespace RISCV;
 
-void FiveStageSimulator::Run() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Run() {
+  history_.reg_base = regs_;
+
   // Main Simulation Loop
   while (true) {
     if (regs_[0] != 0) {
@@ -29,7 +32,7 @@ void FiveStageSimulator::Run() {
 
     // handle branch recoveries
     if (should_recover_branch_) {
-      if (verbose_)
+      if (Verbose())
         printf("branch recovery: new pc 0x%08lx\n", branch_next_pc_);
 
       pc_ = branch_next_pc_;
@@ -53,17 +56,13 @@ void FiveStageSimulator::Run() {
     Fetch();
 
     history_.cycle_count++;
-    history_.reg_record.push_back(GetRegInfoStr());
-    if (history_.reg_record.size() >= 100000) {  // Avoid using up memory
-      history_.reg_record.clear();
-      history_.inst_record.clear();
-    }
+    RecordCycle();
 
-    if (verbose_) {
-      std::cout << GetRegInfoStr();
+    if (Verbose()) {
+      std::cout << GetRegInfoStr(pc_, regs_);
     }
 
-    if (single_step_) {
+    if (SingleStep()) {
       // printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
       char ch;
       while ((ch = getchar()) != '\n') {
@@ -75,10 +74,11 @@ void FiveStageSimulator::Run() {
   }
 }
 
-void FiveStageSimulator::Fetch() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Fetch() {
   // control hazard
   if (true == wait_for_branch_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("control hazard at fetch\n");
     }
     // debug information
@@ -88,7 +88,7 @@ void FiveStageSimulator::Fetch() {
 
   /* if pipeline is stalled (our output slot is not empty), return */
   if (decode_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Fetch: stalled at fetch\n");
     }
     return;
@@ -99,56 +99,57 @@ void FiveStageSimulator::Fetch() {
   }
 
   /* Allocate an op and send it down the pipeline. */
-  auto op = std::make_unique<PipeOp>();
+  auto* op = AllocOp();
   op->inst = memory_->GetInt(pc_);
-  if (verbose_) {
+  if (Verbose()) {
     printf("Fetched instruction 0x%.8x at address 0x%lx\n", op->inst, pc_);
   }
   op->pc = pc_;
-  decode_op_ = std::move(op);
+  decode_op_ = op;
 
   /* update PC */
   pc_ += 4;
 }
 
-void FiveStageSimulator::Decode() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Decode() {
   /* if no op to decode, return */
   if (decode_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("decode: Bubble\n");
     }
     return;
   }
 
-  auto* op = decode_op_.get();
+  auto* op = decode_op_;
   if (op->pc_len != 4) {
     Panic(
         "Current implementation does not support 16bit RV64C instructions!\n");
   }
   try {
-    DecodeInst(op, regs_);
+    const DecodedInst& decoded = decode_cache_.Lookup(op->pc, op->inst);
+    DecodeInst(op, decoded, regs_);
   } catch (const std::exception& e) {
     Panic(e.what());
   }
 
-  history_.inst_record.emplace_back(
-      std::format("{:#010x}: {}\n", op->pc, op->inst_str));
+  history_.inst_record.Push({op->pc, op->inst, history_.reg_record.Pushed()});
 
   /* if downstream stall or occur data hazard, return
    * (and leave any input we had)
    */
   if (execute_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       std::cout << std::format(
           "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-          op->pc, op->inst_str);
+          op->pc, DisassembleInst(op->inst));
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   // data hazard detect at last to show inststr
@@ -160,7 +161,7 @@ void FiveStageSimulator::Decode() {
             rs == data_hazard_mem_op_dest_ || rs == data_hazard_wb_op_dest_);
   };
   if (wait_for_data(op->rs1) || wait_for_data(op->rs2)) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("\tstalled at decode for data hazard\n");
     }
     // debug information
@@ -172,31 +173,32 @@ void FiveStageSimulator::Decode() {
   wait_for_branch_ = IsBranch(op->inst_type) || IsJump(op->inst_type);
 
   /* place op in downstream slot */
-  execute_op_ = std::move(decode_op_);
+  execute_op_ = decode_op_;
   decode_op_ = nullptr;
 }
 
-void FiveStageSimulator::Execute() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Execute() {
   /* if no op to execute, return */
   if (execute_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Execute: Bubble\n");
     }
     return;
   }
-  auto* op = execute_op_.get();
+  auto* op = execute_op_;
 
   /* if downstream stall, return (and leave any input we had) */
   if (mem_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Execute: Stall\n");
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Execute instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
   history_.inst_count++;
 
@@ -227,20 +229,21 @@ void FiveStageSimulator::Execute() {
   data_hazard_execute_op_dest_ = op->dest_reg;
 
   /* remove from upstream stage and place in downstream stage */
-  mem_op_ = std::move(execute_op_);
+  mem_op_ = execute_op_;
   execute_op_ = nullptr;
 }
 
-void FiveStageSimulator::MemoryAccess() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::MemoryAccess() {
   /* if there is no instruction in this pipeline stage, we are done */
   if (!mem_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Memory Access: Bubble\n");
     }
     return;
   }
 
-  PipeOp* op = mem_op_.get();
+  PipeOp* op = mem_op_;
 
   const int64_t& op2 = op->op2;
   const RegId& dest_reg = op->dest_reg;
@@ -250,10 +253,10 @@ void FiveStageSimulator::MemoryAccess() {
   const bool read_sign_ext = op->read_sign_ext;
   const uint32_t mem_len = op->mem_len;
 
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "MemoryAccess instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   data_hazard_mem_op_dest_ = dest_reg;
@@ -278,6 +281,8 @@ void FiveStageSimulator::MemoryAccess() {
       default:
         Panic("Unknown memLen %d\n", mem_len);
     }
+    // self-modifying code must not hit stale decodes
+    decode_cache_.Invalidate(out, mem_len);
   }
 
   if (!good) {
@@ -323,14 +328,15 @@ void FiveStageSimulator::MemoryAccess() {
   data_hazard_mem_op_dest_ = dest_reg;
 
   /* clear stage input and transfer to next stage */
-  wb_op_ = std::move(mem_op_);
+  wb_op_ = mem_op_;
   mem_op_ = nullptr;
 }
 
-void FiveStageSimulator::WriteBack() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::WriteBack() {
   /* if there is no instruction in this pipeline stage, we are done */
   if (!wb_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("WriteBack: Bubble\n");
     }
     return;
@@ -338,11 +344,11 @@ void FiveStageSimulator::WriteBack() {
   // no situation to stall
 
   /* grab the op out of our input slot */
-  PipeOp* op = wb_op_.get();
-  if (verbose_) {
+  PipeOp* op = wb_op_;
+  if (Verbose()) {
     std::cout << std::format(
         "WriteBack instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   /* if this instruction writes a register, do so now */
@@ -350,17 +356,35 @@ void FiveStageSimulator::WriteBack() {
   const RegId& dest_reg = op->dest_reg;
   if (dest_reg > 0) {
     regs_[dest_reg] = op->out;
+    history_.wb_reg = dest_reg;
+    history_.wb_value = op->out;
   }
 
   // data hazard for decode to detect
   data_hazard_wb_op_dest_ = dest_reg;
 
-  /* free the op automatically with unique_ptr */
-  wb_op_.reset();
-  wb_op_ = nullptr;
+  /* return the op to the pool */
+  ReleaseOp(wb_op_);
+}
+
+template <typename Policy>
+PipeOp* FiveStageSimulator<Policy>::AllocOp() {
+  assert(free_op_num_ > 0);
+  auto* op = free_ops_[--free_op_num_];
+  *op = PipeOp{};
+  return op;
+}
+
+template <typename Policy>
+void FiveStageSimulator<Policy>::ReleaseOp(PipeOp*& op) {
+  if (op != nullptr) {
+    free_ops_[free_op_num_++] = op;
+    op = nullptr;
+  }
 }
 
-void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
+template <typename Policy>
+void FiveStageSimulator<Policy>::PipeRecover(uint32_t dest_pc) {
   /* if there is already a recovery scheduled, it must have come from a later
    * stage (which executes older instructions), hence that recovery overrides
    * our recovery. Simply return in this case. */
@@ -372,7 +396,8 @@ void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
   branch_next_pc_ = dest_pc;
 }
 
-void FiveStageSimulator::PrintStatistics() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::PrintStatistics() const {
   printf("------------ STATISTICS -----------\n");
   printf("Number of Instructions: %u\n", history_.inst_count);
   printf("Number of Cycles: %u\n", history_.cycle_count);
@@ -380,14 +405,31 @@ void FiveStageSimulator::PrintStatistics() const {
          (float)history_.cycle_count / history_.inst_count);
   printf("Number of Control Hazards: %u\n", history_.control_hazard_count);
   printf("Number of Data Hazards: %u\n", history_.data_hazard_count);
+  printf("Resident Memory: %lu KB\n", memory_->ResidentSize() / 1024);
   printf("-----------------------------------\n");
 }
 
-std::string FiveStageSimulator::GetRegInfoStr() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::RecordCycle() {
+  auto& reg_record = history_.reg_record;
+  if (reg_record.Size() == reg_record.Capacity()) {
+    // fold the record about to be overwritten into the base state
+    const auto& oldest = reg_record[0];
+    if (oldest.reg > 0) {
+      history_.reg_base[oldest.reg] = oldest.value;
+    }
+  }
+  reg_record.Push({pc_, history_.wb_value, history_.wb_reg});
+  history_.wb_reg = -1;
+}
+
+template <typename Policy>
+std::string FiveStageSimulator<Policy>::GetRegInfoStr(uint64_t pc,
+                                              const Regs& regs) const {
   std::string str = "------------ CPU STATE ------------\n";
-  str += std::format("PC: {:#x}\n", pc_);
+  str += std::format("PC: {:#x}\n", pc);
   for (uint32_t i = 0; i < 32; ++i) {
-    str += std::format("{}: {:#010x}({}) ", REGNAME[i], regs_[i], regs_[i]);
+    str += std::format("{}: {:#010x}({}) ", REGNAME[i], regs[i], regs[i]);
     if (i % 4 == 3) {
       str += "\n";
     }
@@ -396,13 +438,42 @@ std::string FiveStageSimulator::GetRegInfoStr() const {
   return str;
 }
 
-void FiveStageSimulator::DumpHistory() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::DumpHistory() const {
   std::ofstream ofile("dump.txt");
   ofile << "================== Excecution History =================="
         << std::endl;
-  for (uint32_t i = 0; i < history_.inst_record.size(); ++i) {
-    ofile << history_.inst_record[i];
-    ofile << history_.reg_record[i];
+
+  const auto& inst_record = history_.inst_record;
+  const auto& reg_record = history_.reg_record;
+  auto dump_inst = [&](uint64_t i) {
+    ofile << std::format("{:#010x}: {}\n", inst_record[i].pc,
+                         DisassembleInst(inst_record[i].inst));
+  };
+
+  // each instruction is dumped with the CPU state after the cycle it is
+  // decoded in, rebuilt by replaying register writes from reg_base
+  Regs regs = history_.reg_base;
+  uint64_t first_cycle = reg_record.Pushed() - reg_record.Size();
+  uint64_t i = 0;
+  while (i < inst_record.Size() && inst_record[i].cycle < first_cycle) {
+    ++i;
+  }
+  for (uint64_t c = 0; c < reg_record.Size(); ++c) {
+    const auto& record = reg_record[c];
+    if (record.reg > 0) {
+      regs[record.reg] = record.value;
+    }
+    for (; i < inst_record.Size() && inst_record[i].cycle == first_cycle + c;
+         ++i) {
+      dump_inst(i);
+      ofile << GetRegInfoStr(record.pc, regs);
+    }
+  }
+  // instructions of the unfinished cycle, e.g. when panicking
+  for (; i < inst_record.Size(); ++i) {
+    dump_inst(i);
+    ofile << GetRegInfoStr(pc_, regs_);
   }
   ofile << "========================================================"
         << std::endl;
@@ -410,3 +481,7 @@ void FiveStageSimulator::DumpHistory() const {
 
   ofile.close();
 }
+
+// the only two instantiations, selected in Simulator::Create
+template class FiveStageSimulator<DebugTrace>;
+template class FiveStageSimulator<NoTrace>;
@@ -15,7 +15,8 @@ struct Options {
   bool verbose = false;
   bool single_step = false;
   bool dump_history = false;
-  uint32_t memory_size = 100 * 1024 * 1024;
+  // allocated lazily, up to the whole 32-bit address space
+  uint64_t memory_size = 100 * 1024 * 1024;
 
   static Options Parse(int argc, char** argv) {
     Options opts;
@@ -31,8 +32,10 @@ struct Options {
                  "Enable single-step execution");
     app.add_flag("-d,--dump_history", opts.dump_history,
                  "Dump execution history to dump.txt");
-    app.add_option("--memory_size", opts.memory_size, "Memory size in bytes")
-        ->default_val(opts.memory_size);
+    app.add_option("--memory_size", opts.memory_size,
+                   "Memory size in bytes, at most 4G")
+        ->default_val(opts.memory_size)
+        ->check(CLI::Range(uint64_t(1), uint64_t(1) << 32));
     app.add_option("--pipeline_mode", opts.pipeline_mode, "Pipeline mode")
         ->default_val(opts.pipeline_mode)
         ->check(CLI::IsMember(pipeline_modes));
@@ -57,16 +57,14 @@ int64_t HandleSystemCall(bool* exit_ctrl, int64_t type /* REG_A7 */,
   return arg1;
 }
 
-void DecodeInst(PipeOp* op, const Regs& regs) {
-  std::string inst_name;
-  std::string& inst_str = op->inst_str;
-  std::string dest_str, op1_str, op2_str, offset_str;
-  InstType& inst_type = op->inst_type;
-  uint32_t inst = op->inst;
-  // op1, op2 and offset are values
-  int64_t &op1 = op->op1, &op2 = op->op2, &offset = op->offset;
+DecodedInst PredecodeInst(uint32_t inst) {
+  DecodedInst decoded;
+  InstType& inst_type = decoded.inst_type;
+  // imm and offset are values
+  int32_t &imm = decoded.imm, &offset = decoded.offset;
   // reg1 and reg2 are operands
-  RegId &dest_reg = op->dest_reg, &reg1 = op->rs1, &reg2 = op->rs2;
+  int8_t &dest_reg = decoded.dest_reg, &reg1 = decoded.rs1,
+         &reg2 = decoded.rs2;
 
   uint32_t opcode = inst & 0x7F;
   uint32_t funct3 = (inst >> 12) & 0x7;
@@ -89,8 +87,6 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
 
   switch (opcode) {
     case OP_REG:
-      op1 = regs[rs1];
-      op2 = regs[rs2];
       reg1 = rs1;
       reg2 = rs2;
       dest_reg = rd;
@@ -173,16 +169,10 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown Funct3 field {:#x}\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = REGNAME[rs2];
-      dest_str = REGNAME[rd];
-      inst_str = inst_name + " " + dest_str + "," + op1_str + "," + op2_str;
       break;
     case OP_IMM:
-      op1 = regs[rs1];
       reg1 = rs1;
-      op2 = imm_i;
+      imm = imm_i;
       dest_reg = rd;
       switch (funct3) {
         case 0x0:
@@ -205,15 +195,15 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           break;
         case 0x1:
           inst_type = SLLI;
-          op2 = op2 & 0x3F;
+          imm = imm & 0x3F;
           break;
         case 0x5:
           if (((inst >> 26) & 0x3F) == 0x0) {
             inst_type = SRLI;
-            op2 = op2 & 0x3F;
+            imm = imm & 0x3F;
           } else if (((inst >> 26) & 0x3F) == 0x10) {
             inst_type = SRAI;
-            op2 = op2 & 0x3F;
+            imm = imm & 0x3F;
           } else {
             throw std::runtime_error(std::format(
                 "Unknown funct7 {:#x} for OP_IMM\n", (inst >> 26) & 0x3F));
@@ -223,60 +213,32 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown Funct3 field {:#x}\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = std::to_string(op2);
-      dest_str = REGNAME[dest_reg];
-      inst_str = inst_name + " " + dest_str + "," + op1_str + "," + op2_str;
       break;
     case OP_LUI:
-      op1 = imm_u;
-      op2 = 0;
+      imm = imm_u;
       offset = imm_u;
       dest_reg = rd;
       inst_type = LUI;
-      inst_name = INSTNAME[inst_type];
-      op1_str = std::to_string(imm_u);
-      dest_str = REGNAME[dest_reg];
-      inst_str = inst_name + " " + dest_str + "," + op1_str;
       break;
     case OP_AUIPC:
-      op1 = imm_u;
-      op2 = 0;
+      imm = imm_u;
       offset = imm_u;
       dest_reg = rd;
       inst_type = AUIPC;
-      inst_name = INSTNAME[inst_type];
-      op1_str = std::to_string(imm_u);
-      dest_str = REGNAME[dest_reg];
-      inst_str = inst_name + " " + dest_str + "," + op1_str;
       break;
     case OP_JAL:
-      op1 = imm_uj;
-      op2 = 0;
+      imm = imm_uj;
       offset = imm_uj;
       dest_reg = rd;
       inst_type = JAL;
-      inst_name = INSTNAME[inst_type];
-      op1_str = std::to_string(imm_uj);
-      dest_str = REGNAME[dest_reg];
-      inst_str = inst_name + " " + dest_str + "," + op1_str;
       break;
     case OP_JALR:
-      op1 = regs[rs1];
       reg1 = rs1;
-      op2 = imm_i;
+      imm = imm_i;
       dest_reg = rd;
       inst_type = JALR;
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = std::to_string(op2);
-      dest_str = REGNAME[dest_reg];
-      inst_str = inst_name + " " + dest_str + "," + op1_str + "," + op2_str;
       break;
     case OP_BRANCH:
-      op1 = regs[rs1];
-      op2 = regs[rs2];
       reg1 = rs1;
       reg2 = rs2;
       offset = imm_sb;
@@ -303,15 +265,8 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown funct3 {:#x} at OP_BRANCH\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = REGNAME[rs2];
-      offset_str = std::to_string(offset);
-      inst_str = inst_name + " " + op1_str + "," + op2_str + "," + offset_str;
       break;
     case OP_STORE:
-      op1 = regs[rs1];
-      op2 = regs[rs2];
       reg1 = rs1;
       reg2 = rs2;
       offset = imm_s;
@@ -332,17 +287,10 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown funct3 {:#x} for OP_STORE\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = REGNAME[rs2];
-      offset_str = std::to_string(offset);
-      inst_str =
-          inst_name + " " + op2_str + "," + offset_str + "(" + op1_str + ")";
       break;
     case OP_LOAD:
-      op1 = regs[rs1];
       reg1 = rs1;
-      op2 = imm_i;
+      imm = imm_i;
       offset = imm_i;
       dest_reg = rd;
       switch (funct3) {
@@ -371,17 +319,9 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown funct3 {:#x} for OP_LOAD\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = std::to_string(op2);
-      dest_str = REGNAME[rd];
-      inst_str =
-          inst_name + " " + dest_str + "," + op2_str + "(" + op1_str + ")";
       break;
     case OP_SYSTEM:
       if (funct3 == 0x0 && funct7 == 0x000) {
-        op1 = regs[REG_A0];
-        op2 = regs[REG_A7];
         reg1 = REG_A0;
         reg2 = REG_A7;
         dest_reg = REG_A0;
@@ -391,13 +331,10 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
             "Unknown OP_SYSTEM inst with funct3 {:#x} and funct7 {:#x}\n",
             funct3, funct7));
       }
-      inst_name = INSTNAME[inst_type];
-      inst_str = inst_name;
       break;
     case OP_IMM32:
-      op1 = regs[rs1];
       reg1 = rs1;
-      op2 = imm_i;
+      imm = imm_i;
       dest_reg = rd;
       switch (funct3) {
         case 0x0:
@@ -420,15 +357,8 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown funct3 {:#x} for OP_ADDIW\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = std::to_string(op2);
-      dest_str = REGNAME[rd];
-      inst_str = inst_name + " " + dest_str + "," + op1_str + "," + op2_str;
       break;
     case OP_32: {
-      op1 = regs[rs1];
-      op2 = regs[rs2];
       reg1 = rs1;
       reg2 = rs2;
       dest_reg = rd;
@@ -467,16 +397,80 @@ void DecodeInst(PipeOp* op, const Regs& regs) {
           throw std::runtime_error(
               std::format("Unknown 32bit funct3 {:#x}\n", funct3));
       }
-      inst_name = INSTNAME[inst_type];
-      op1_str = REGNAME[rs1];
-      op2_str = REGNAME[rs2];
-      dest_str = REGNAME[rd];
-      inst_str = inst_name + " " + dest_str + "," + op1_str + "," + op2_str;
     } break;
     default:
       throw std::runtime_error(
           std::format("Unsupported opcode {:#x}\n", opcode));
   }
+  return decoded;
+}
+
+void DecodeInst(PipeOp* op, const DecodedInst& decoded, const Regs& regs) {
+  op->inst_type = decoded.inst_type;
+  op->rs1 = decoded.rs1;
+  op->rs2 = decoded.rs2;
+  op->dest_reg = decoded.dest_reg;
+  op->offset = decoded.offset;
+  // the immediate stands in for the first missing register operand
+  if (decoded.rs1 < 0) {
+    op->op1 = decoded.imm;
+    op->op2 = 0;
+  } else {
+    op->op1 = regs[decoded.rs1];
+    op->op2 = decoded.rs2 < 0 ? decoded.imm : regs[decoded.rs2];
+  }
+}
+
+std::string DisassembleInst(const DecodedInst& decoded) {
+  const InstType inst_type = decoded.inst_type;
+  const char* inst_name = INSTNAME[inst_type];
+  const char* dest_str = decoded.dest_reg < 0 ? "" : REGNAME[decoded.dest_reg];
+  const char* op1_str = decoded.rs1 < 0 ? "" : REGNAME[decoded.rs1];
+  const char* op2_str = decoded.rs2 < 0 ? "" : REGNAME[decoded.rs2];
+
+  switch (inst_type) {
+    case LUI:
+    case AUIPC:
+    case JAL:
+      return std::format("{} {},{}", inst_name, dest_str, decoded.imm);
+    case BEQ:
+    case BNE:
+    case BLT:
+    case BGE:
+    case BLTU:
+    case BGEU:
+      return std::format("{} {},{},{}", inst_name, op1_str, op2_str,
+                         decoded.offset);
+    case SB:
+    case SH:
+    case SW:
+    case SD:
+      return std::format("{} {},{}({})", inst_name, op2_str, decoded.offset,
+                         op1_str);
+    case LB:
+    case LH:
+    case LW:
+    case LD:
+    case LBU:
+    case LHU:
+    case LWU:
+      return std::format("{} {},{}({})", inst_name, dest_str, decoded.imm,
+                         op1_str);
+    case ECALL:
+      return inst_name;
+    default:
+      if (decoded.rs2 < 0) {
+        // register-immediate
+        return std::format("{} {},{},{}", inst_name, dest_str, op1_str,
+                           decoded.imm);
+      }
+      return std::format("{} {},{},{}", inst_name, dest_str, op1_str,
+                         op2_str);
+  }
+}
+
+std::string DisassembleInst(uint32_t inst) {
+  return DisassembleInst(PredecodeInst(inst));
 }
 
 void ExecuteInst(PipeOp* op, bool* exit_ctrl, const Memory* mem) {
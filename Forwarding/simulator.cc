@@ -29,7 +29,11 @@ Simulator::Simulator(const Options& opts)
 std::unique_ptr<Simulator> Simulator::Create(const Options& opts) {
   if (opts.pipeline_mode == "five-stage") {
     // for simplicity since base class shouldn't know its successor
-    return std::make_unique<FiveStageSimulator>(opts);
+    // tracing is compiled out unless it is asked for
+    if (opts.verbose || opts.single_step) {
+      return std::make_unique<FiveStageSimulator<DebugTrace>>(opts);
+    }
+    return std::make_unique<FiveStageSimulator<NoTrace>>(opts);
   } else {
     // shouldn't reach here since abnormal inputs are handled when parsing
     std::cerr << std::format("Unknown pipeline mode {}\n", opts.pipeline_mode);
@@ -60,7 +64,6 @@ void Simulator::InitStack(uint32_t stack_base, uint32_t stack_size) {
   regs_[RISCV::REG_SP] = stack_base;
   stack_base_ = stack_base;
   stack_size_ = stack_size;
-  for (uint32_t addr = stack_base; addr > stack_base - stack_size; addr--) {
-    memory_->SetByte(addr, 0);
-  }
+  // (stack_base - stack_size, stack_base], normally still untouched
+  memory_->Zero(stack_base - stack_size + 1, stack_size);
 }
@@ -0,0 +1,37 @@
+#include "access_trace.h"
+
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+AccessTrace::AccessTrace(const std::string& path)
+    : out_(path, std::ios::binary), path_(path) {
+  if (!out_) {
+    throw std::runtime_error(std::format("Cannot write {}\n", path));
+  }
+  out_.write(MAGIC, sizeof(MAGIC));
+}
+
+AccessTrace::~AccessTrace() {
+  // too late to report errors
+  out_.write(reinterpret_cast<const char*>(buf_.data()), pos_);
+}
+
+void AccessTrace::Flush() {
+  out_.write(reinterpret_cast<const char*>(buf_.data()), pos_);
+  out_.flush();
+  pos_ = 0;
+  if (!out_) {
+    throw std::runtime_error(std::format("Cannot write {}\n", path_));
+  }
+}
+
+AccessTraceReader::AccessTraceReader(const std::string& path)
+    : file_(path), in_(file_.Data()) {
+  if (in_.size() < sizeof(AccessTrace::MAGIC) ||
+      std::memcmp(in_.data(), AccessTrace::MAGIC,
+                  sizeof(AccessTrace::MAGIC)) != 0) {
+    throw std::runtime_error(std::format("{} is not an access trace\n", path));
+  }
+  in_ = in_.subspan(sizeof(AccessTrace::MAGIC));
+}
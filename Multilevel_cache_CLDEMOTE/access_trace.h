@@ -0,0 +1,161 @@
+#ifndef SRC_ACCESS_TRACE_H
+#define SRC_ACCESS_TRACE_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "checkpoint.h"
+
+// binary trace of every access made through the MemoryManager, written
+// through a buffer. the file is MAGIC followed by records of
+//   header byte: bits 0-1 type, bits 2-3 log2 of the size,
+//                PC_DELTA / ADDR_DELTA set if that field follows
+//   pc delta:    zigzag varint, from the last fetch pc + 4 for a fetch and
+//                from the pc of the previous record otherwise
+//   addr delta:  zigzag varint from the address of the previous record
+//                other than a fetch, never present for a fetch whose
+//                address is its pc
+// omitted deltas are zero, so straight-line fetches take one byte each
+class AccessTrace {
+ public:
+  // DEMOTE is the CLDEMOTE hint of the line holding addr
+  enum Type : uint8_t { FETCH, LOAD, STORE, DEMOTE };
+
+  static constexpr char MAGIC[8] = {'R', 'V', 'M', 'T', 'R', 'C', '0', '1'};
+  static constexpr uint8_t TYPE_MASK = 0x3;
+  static constexpr uint8_t SIZE_SHIFT = 2;
+  static constexpr uint8_t PC_DELTA = 1 << 4;
+  static constexpr uint8_t ADDR_DELTA = 1 << 5;
+
+  // delta decoding state, shared by the writer and readers
+  struct State {
+    uint64_t fetch_pc = 0;
+    uint64_t pc = 0;
+    uint32_t addr = 0;
+  };
+
+ private:
+  static constexpr uint32_t BUFFER_SIZE = 1 << 16;
+  // header and two 64-bit varints
+  static constexpr uint32_t MAX_RECORD = 1 + 10 + 10;
+
+  std::ofstream out_;
+  std::string path_;
+  std::array<uint8_t, BUFFER_SIZE> buf_;
+  uint32_t pos_ = 0;
+  State last_;
+
+  void PutVarint(int64_t value) {
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while (zigzag >= 0x80) {
+      buf_[pos_++] = (zigzag & 0x7F) | 0x80;
+      zigzag >>= 7;
+    }
+    buf_[pos_++] = zigzag;
+  }
+
+ public:
+  explicit AccessTrace(const std::string& path);
+  // records not flushed yet are written, but failures go unnoticed
+  ~AccessTrace();
+  AccessTrace(const AccessTrace&) = delete;
+  AccessTrace& operator=(const AccessTrace&) = delete;
+
+  // `size` is 1, 2, 4 or 8
+  void Record(Type type, uint64_t pc, uint32_t addr, uint32_t size) {
+    if (pos_ + MAX_RECORD > BUFFER_SIZE) {
+      Flush();
+    }
+    uint8_t& header = buf_[pos_++];
+    header = type | std::countr_zero(size) << SIZE_SHIFT;
+    int64_t pc_delta =
+        pc - (type == FETCH ? last_.fetch_pc + 4 : last_.pc);
+    if (pc_delta != 0) {
+      header |= PC_DELTA;
+      PutVarint(pc_delta);
+    }
+    last_.pc = pc;
+    if (type == FETCH) {
+      last_.fetch_pc = pc;
+      return;
+    }
+    int64_t addr_delta = (int64_t)addr - last_.addr;
+    if (addr_delta != 0) {
+      header |= ADDR_DELTA;
+      PutVarint(addr_delta);
+    }
+    last_.addr = addr;
+  }
+
+  // write out the buffered records
+  void Flush();
+};
+
+// reads back a trace written by AccessTrace, mapped in whole
+class AccessTraceReader {
+ public:
+  struct Access {
+    AccessTrace::Type type;
+    uint64_t pc;
+    uint32_t addr;
+    uint32_t size;
+  };
+
+ private:
+  Checkpoint::MappedFile file_;
+  std::span<const uint8_t> in_;
+  AccessTrace::State last_;
+
+  int64_t GetVarint() {
+    uint64_t zigzag = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+      if (in_.empty() || shift > 63) {
+        throw std::runtime_error("Truncated access trace\n");
+      }
+      uint8_t byte = in_[0];
+      in_ = in_.subspan(1);
+      zigzag |= (uint64_t)(byte & 0x7F) << shift;
+      if (byte < 0x80) {
+        break;
+      }
+    }
+    return (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  }
+
+ public:
+  explicit AccessTraceReader(const std::string& path);
+
+  // false at the end of the trace
+  bool Next(Access& access) {
+    if (in_.empty()) {
+      return false;
+    }
+    uint8_t header = in_[0];
+    in_ = in_.subspan(1);
+    access.type = static_cast<AccessTrace::Type>(header &
+                                                 AccessTrace::TYPE_MASK);
+    access.size = 1 << ((header >> AccessTrace::SIZE_SHIFT) & 0x3);
+    int64_t pc_delta = header & AccessTrace::PC_DELTA ? GetVarint() : 0;
+    if (access.type == AccessTrace::FETCH) {
+      last_.fetch_pc += 4 + pc_delta;
+      last_.pc = last_.fetch_pc;
+      access.pc = last_.pc;
+      access.addr = last_.pc;
+      return true;
+    }
+    last_.pc += pc_delta;
+    if (header & AccessTrace::ADDR_DELTA) {
+      last_.addr += GetVarint();
+    }
+    access.pc = last_.pc;
+    access.addr = last_.addr;
+    return true;
+  }
+};
+
+#endif
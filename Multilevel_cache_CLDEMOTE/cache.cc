@@ -1,42 +1,79 @@
 #include "cache.h"
 
+#include <algorithm>
+
+#include "checkpoint.h"
+
 void TieredCache::ReadSpan(uint32_t addr, std::span<uint8_t> out) {
+  if (opts_.cache_model == CacheModel::Timing) {
+    main_memory_->ReadSpan(addr, out);
+    Access(addr, out.size(), false);
+    return;
+  }
+
   current_cycle_++;
   uint32_t latency = 0;
   last_access_latency_ = 0;
 
   if (levels_.empty()) {
-    ReadFromMemory(addr, out, latency);
+    ReadFromMemory(addr, out.size(), out.data(), latency);
   } else {
-    HandleRead(0, addr, out, latency);
+    HandleRead(0, addr, out.size(), out.data(), latency);
   }
 
   last_access_latency_ = latency;
 }
 
 void TieredCache::WriteSpan(uint32_t addr, std::span<const uint8_t> in) {
+  if (opts_.cache_model == CacheModel::Timing) {
+    main_memory_->WriteSpan(addr, in);
+    Access(addr, in.size(), true);
+    return;
+  }
+
   current_cycle_++;
   uint32_t latency = 0;
   last_access_latency_ = 0;
 
   if (levels_.empty()) {
-    WriteToMemory(addr, in, latency);
+    WriteToMemory(addr, in.size(), in.data(), latency);
   } else {
-    HandleWrite(0, addr, in, latency);
+    HandleWrite(0, addr, in.size(), in.data(), latency);
   }
   
   last_access_latency_ = latency;
 }
 
-void TieredCache::HandleRead(size_t level_idx, uint64_t addr, std::span<uint8_t> out, uint32_t& latency, bool is_write_alloc) {
+void TieredCache::Access(uint32_t addr, uint32_t size, bool write) {
+  current_cycle_++;
+  uint32_t latency = 0;
+  last_access_latency_ = 0;
+
+  if (levels_.empty()) {
+    if (write) {
+      WriteToMemory(addr, size, nullptr, latency);
+    } else {
+      ReadFromMemory(addr, size, nullptr, latency);
+    }
+  } else if (write) {
+    HandleWrite(0, addr, size, nullptr, latency);
+  } else {
+    HandleRead(0, addr, size, nullptr, latency);
+  }
+
+  last_access_latency_ = latency;
+}
+
+void TieredCache::HandleRead(size_t level_idx, uint64_t addr, uint64_t size, uint8_t* out, uint32_t& latency, bool is_write_alloc) {
   CacheLevel* level = levels_[level_idx].get();
   
   uint64_t offset = level->GetOffset(addr);
   uint64_t remaining_in_line = level->config_.line_size - offset;
 
-  if (out.size() > remaining_in_line) {
-      HandleRead(level_idx, addr, out.subspan(0, remaining_in_line), latency, is_write_alloc);
-      HandleRead(level_idx, addr + remaining_in_line, out.subspan(remaining_in_line), latency, is_write_alloc);
+  if (size > remaining_in_line) {
+      HandleRead(level_idx, addr, remaining_in_line, out, latency, is_write_alloc);
+      HandleRead(level_idx, addr + remaining_in_line, size - remaining_in_line,
+                 out ? out + remaining_in_line : nullptr, latency, is_write_alloc);
       return;
   }
 
@@ -46,25 +83,27 @@ void TieredCache::HandleRead(size_t level_idx, uint64_t addr, std::span<uint8_t>
   level->stats_.accesses++;
 
   uint64_t tag, index;
-  CacheLine* line = level->Find(addr, &tag, &index);
+  uint64_t line = level->Find(addr, &tag, &index);
 
-  if (line) {
+  if (line != CacheLevel::NO_LINE) {
     // Read Hit
     level->stats_.hits++;
-    Log(std::format("L{} Read Hit: addr=0x{:x}", level_idx + 1, addr));
+    Log(CacheTrace::READ_HIT, level_idx, addr);
     
-    level->UpdateLRU(line, current_cycle_);
+    level->Touch(line);
 
-    std::memcpy(out.data(), line->data.data() + offset, out.size());
+    if (out) {
+      std::memcpy(out, level->Data(line) + offset, size);
+    }
     return;
   }
 
   // Read Miss
   level->stats_.misses++;
-  Log(std::format("L{} Read Miss: addr=0x{:x}", level_idx + 1, addr));
+  Log(CacheTrace::READ_MISS, level_idx, addr);
 
-  CacheLine* victim_line = nullptr;
-  CacheLine* new_line = level->Allocate(addr, &victim_line, current_cycle_);
+  const CacheLine* victim_line = nullptr;
+  uint64_t new_line = level->Allocate(addr, &victim_line);
   uint64_t victim_addr = 0;
 
   if (victim_line) {
@@ -72,50 +111,50 @@ void TieredCache::HandleRead(size_t level_idx, uint64_t addr, std::span<uint8_t>
   }
 
   if (opts_.inclusion_policy == InclusionPolicy::Inclusive && victim_line) {
-    Log(std::format("L{} Inclusive Back-Invalidate: addr=0x{:x}", level_idx + 1, victim_addr));
+    Log(CacheTrace::INCLUSIVE_BACK_INVALIDATE, level_idx, victim_addr);
     BackInvalidate(level_idx - 1, victim_addr);
   }
 
   // Task 1
   if (victim_line) {
-    Evict(level_idx, victim_line, victim_addr, latency);
-    delete victim_line;
+    Evict(level_idx, victim_line->dirty, victim_line->data.get(), victim_addr, latency);
+    level->ReleaseVictim();
     victim_line = nullptr;
   }
 
-  std::vector<uint8_t> line_buffer(level->config_.line_size);
   uint64_t line_addr = level->GetAddr(tag, index);
 
+  // filled in place, only this level writes its lines
   if (level_idx + 1 < levels_.size()) {
     
-    HandleRead(level_idx + 1, line_addr, std::span<uint8_t>(line_buffer.data(), line_buffer.size()), latency, is_write_alloc);
+    HandleRead(level_idx + 1, line_addr, level->config_.line_size, level->Data(new_line), latency, is_write_alloc);
   } else {
-    ReadFromMemory(line_addr, std::span<uint8_t>(line_buffer.data(), line_buffer.size()), latency);
+    ReadFromMemory(line_addr, level->config_.line_size, level->Data(new_line), latency);
   }
 
-  std::memcpy(new_line->data.data(), line_buffer.data(), level->config_.line_size);
-  new_line->valid = true;
-  new_line->dirty = false;
-  new_line->tag = tag;
-  level->UpdateLRU(new_line, current_cycle_);
+  level->Fill(new_line, tag);
+  level->Touch(new_line);
 
   // Exclusive
   if (opts_.inclusion_policy == InclusionPolicy::Exclusive && !is_write_alloc) {
       InvalidateInLowerLevels(level_idx + 1, line_addr);
   }
 
-  std::memcpy(out.data(), new_line->data.data() + offset, out.size());
+  if (out) {
+    std::memcpy(out, level->Data(new_line) + offset, size);
+  }
 }
 
 
-void TieredCache::HandleWrite(size_t level_idx, uint64_t addr, std::span<const uint8_t> in, uint32_t& latency) {
+void TieredCache::HandleWrite(size_t level_idx, uint64_t addr, uint64_t size, const uint8_t* in, uint32_t& latency) {
   CacheLevel* level = levels_[level_idx].get();
   
   uint64_t offset = level->GetOffset(addr);
   uint64_t remaining_in_line = level->config_.line_size - offset;
-  if (in.size() > remaining_in_line) {
-      HandleWrite(level_idx, addr, in.subspan(0, remaining_in_line), latency);
-      HandleWrite(level_idx, addr + remaining_in_line, in.subspan(remaining_in_line), latency);
+  if (size > remaining_in_line) {
+      HandleWrite(level_idx, addr, remaining_in_line, in, latency);
+      HandleWrite(level_idx, addr + remaining_in_line, size - remaining_in_line,
+                  in ? in + remaining_in_line : nullptr, latency);
       return;
   }
 
@@ -123,16 +162,18 @@ void TieredCache::HandleWrite(size_t level_idx, uint64_t addr, std::span<const u
   level->stats_.accesses++;
 
   uint64_t tag, index;
-  CacheLine* line = level->Find(addr, &tag, &index);
+  uint64_t line = level->Find(addr, &tag, &index);
 
-  if (line) {
+  if (line != CacheLevel::NO_LINE) {
     // Write Hit[WBWA]
     level->stats_.hits++;
-    Log(std::format("L{} Write Hit: addr=0x{:x}", level_idx + 1, addr));
+    Log(CacheTrace::WRITE_HIT, level_idx, addr);
     
-    level->UpdateLRU(line, current_cycle_);
-    std::memcpy(line->data.data() + offset, in.data(), in.size());
-    line->dirty = true;
+    level->Touch(line);
+    if (in) {
+      std::memcpy(level->Data(line) + offset, in, size);
+    }
+    level->SetDirty(line, true);
 
     if (opts_.inclusion_policy == InclusionPolicy::Exclusive) {
         InvalidateInLowerLevels(level_idx + 1, level->GetAddr(tag, index));
@@ -142,21 +183,23 @@ void TieredCache::HandleWrite(size_t level_idx, uint64_t addr, std::span<const u
 
   // Write Miss
   level->stats_.misses++;
-  Log(std::format("L{} Write Miss: addr=0x{:x}", level_idx + 1, addr));
+  Log(CacheTrace::WRITE_MISS, level_idx, addr);
 
   // Task 1
-  std::vector<uint8_t> dummy_out(in.size());
-  HandleRead(level_idx, addr, std::span<uint8_t>(dummy_out.data(), dummy_out.size()), latency, true);
+  // only brings the line in, nothing is read out
+  HandleRead(level_idx, addr, size, nullptr, latency, true);
 
   line = level->Find(addr, &tag, &index);
-  if (!line) {
+  if (line == CacheLevel::NO_LINE) {
     throw std::runtime_error("Cache logic error: Line not found after Write-Allocate");
   }
 
-  Log(std::format("L{} Write-Allocate complete, performing write: addr=0x{:x}", level_idx + 1, addr));
-  level->UpdateLRU(line, current_cycle_);
-  std::memcpy(line->data.data() + offset, in.data(), in.size());
-  line->dirty = true;
+  Log(CacheTrace::WRITE_ALLOCATE, level_idx, addr);
+  level->Touch(line);
+  if (in) {
+    std::memcpy(level->Data(line) + offset, in, size);
+  }
+  level->SetDirty(line, true);
   
   // (Exclusive)
   if (opts_.inclusion_policy == InclusionPolicy::Exclusive) {
@@ -164,33 +207,31 @@ void TieredCache::HandleWrite(size_t level_idx, uint64_t addr, std::span<const u
   }
 }
 
-void TieredCache::Evict(size_t level_idx, CacheLine* victim_line, uint64_t victim_addr, uint32_t& latency) {
+void TieredCache::Evict(size_t level_idx, bool dirty, const uint8_t* data, uint64_t victim_addr, uint32_t& latency) {
   CacheLevel* level = levels_[level_idx].get();
   level->stats_.evictions++;
-  Log(std::format("L{} Evict: addr=0x{:x} (Dirty={})", level_idx + 1, victim_addr, victim_line->dirty));
+  Log(dirty ? CacheTrace::EVICT_DIRTY : CacheTrace::EVICT_CLEAN, level_idx, victim_addr);
 
-  if (victim_line->dirty) {
+  if (dirty) {
     level->stats_.writebacks++;
-    Log(std::format("L{} Write-Back: addr=0x{:x}", level_idx + 1, victim_addr));
-    
-    std::span<const uint8_t> data_to_write(victim_line->data.data(), victim_line->data.size());
+    Log(CacheTrace::WRITE_BACK, level_idx, victim_addr);
+
 
     if (level_idx + 1 < levels_.size()) {
 
-      HandleWrite(level_idx + 1, victim_addr, data_to_write, latency);
+      HandleWrite(level_idx + 1, victim_addr, level->config_.line_size, data, latency);
     } else {
 
-      WriteToMemory(victim_addr, data_to_write, latency);
+      WriteToMemory(victim_addr, level->config_.line_size, data, latency);
     }
 
   }
 
   else if (opts_.inclusion_policy == InclusionPolicy::Exclusive) {
     if (level_idx + 1 < levels_.size()) {
-      Log(std::format("L{} Exclusive Push-Down: addr=0x{:x}", level_idx + 1, victim_addr));
+      Log(CacheTrace::EXCLUSIVE_PUSH_DOWN, level_idx, victim_addr);
 
-      std::span<const uint8_t> data_to_write(victim_line->data.data(), victim_line->data.size());
-      HandleWrite(level_idx + 1, victim_addr, data_to_write, latency);
+      HandleWrite(level_idx + 1, victim_addr, level->config_.line_size, data, latency);
     }
   }
 }
@@ -201,18 +242,18 @@ void TieredCache::BackInvalidate(int level_idx, uint64_t addr) {
 
   CacheLevel* level = levels_[level_idx].get();
   uint64_t tag, index;
-  CacheLine* line = level->Find(addr, &tag, &index);
+  uint64_t line = level->Find(addr, &tag, &index);
 
-  if (line) {
-    Log(std::format("L{} Back-Invalidated: addr=0x{:x}", level_idx + 1, addr));
+  if (line != CacheLevel::NO_LINE) {
+    Log(CacheTrace::BACK_INVALIDATED, level_idx, addr);
     // (Inclusive)
-    if (line->dirty) {
+    if (level->Dirty(line)) {
       uint32_t dummy_latency = 0;
       uint64_t victim_addr = level->GetAddr(tag, index);
 
-      Evict(level_idx, line, victim_addr, dummy_latency);
+      Evict(level_idx, true, level->Data(line), victim_addr, dummy_latency);
     }
-    line->valid = false;
+    level->Invalidate(line);
   }
 
   BackInvalidate(level_idx - 1, addr);
@@ -223,12 +264,12 @@ void TieredCache::InvalidateInLowerLevels(size_t level_idx, uint64_t addr) {
   if (level_idx >= levels_.size()) return;
 
   CacheLevel* level = levels_[level_idx].get();
-  CacheLine* line = level->Find(addr, nullptr, nullptr);
+  uint64_t line = level->Find(addr, nullptr, nullptr);
 
-  if (line) {
-    Log(std::format("L{} Exclusive Invalidate: addr=0x{:x}", level_idx + 1, addr));
-    line->valid = false;
-    line->dirty = false;
+  if (line != CacheLevel::NO_LINE) {
+    Log(CacheTrace::EXCLUSIVE_INVALIDATE, level_idx, addr);
+    level->Invalidate(line);
+    level->SetDirty(line, false);
   }
   
   InvalidateInLowerLevels(level_idx + 1, addr);
@@ -241,14 +282,14 @@ void TieredCache::Demote(uint32_t addr) {
   if (levels_.empty()) return;
 
   current_cycle_++;
-  Log(std::format("CLDEMOTE: addr=0x{:x}", addr));
+  Log(CacheTrace::DEMOTE, -1, addr);
   
   CacheLevel* l1 = levels_[0].get();
   uint64_t tag, index;
-  CacheLine* line = l1->Find(addr, &tag, &index);
+  uint64_t line = l1->Find(addr, &tag, &index);
 
-  if (!line) {
-    Log("CLDEMOTE: L1 Miss, no action.");
+  if (line == CacheLevel::NO_LINE) {
+    Log(CacheTrace::DEMOTE_MISS, -1);
     return;
   }
 
@@ -257,35 +298,42 @@ void TieredCache::Demote(uint32_t addr) {
 
   if (opts_.inclusion_policy == InclusionPolicy::Inclusive) {
     // Inclusive。
-    Log("CLDEMOTE: Inclusive policy, evicting from L1.");
-    Evict(0, line, line_addr, dummy_latency);
-    line->valid = false;
+    Log(CacheTrace::DEMOTE_INCLUSIVE, -1);
+    Evict(0, l1->Dirty(line), l1->Data(line), line_addr, dummy_latency);
+    l1->Invalidate(line);
   } else {
     // Exclusive
-    Log("CLDEMOTE: Exclusive policy, moving from L1 to L2.");
-    Evict(0, line, line_addr, dummy_latency);
-    line->valid = false;
+    Log(CacheTrace::DEMOTE_EXCLUSIVE, -1);
+    Evict(0, l1->Dirty(line), l1->Data(line), line_addr, dummy_latency);
+    l1->Invalidate(line);
   }
 }
 
-void TieredCache::ReadFromMemory(uint64_t addr, std::span<uint8_t> out, uint32_t& latency) {
-  Log(std::format("Memory Read: addr=0x{:x}", addr));
+void TieredCache::ReadFromMemory(uint64_t addr, uint64_t size, uint8_t* out, uint32_t& latency) {
+  Log(CacheTrace::MEMORY_READ, -1, addr);
   if (opts_.enable_latency) {
     latency += opts_.memory_latency;
   }
-  main_memory_->ReadSpan(addr, out);
+  if (out) {
+    main_memory_->ReadSpan(addr, std::span<uint8_t>(out, size));
+  }
 }
 
-void TieredCache::WriteToMemory(uint64_t addr, std::span<const uint8_t> in, uint32_t& latency) {
-  Log(std::format("Memory Write: addr=0x{:x}", addr));
+void TieredCache::WriteToMemory(uint64_t addr, uint64_t size, const uint8_t* in, uint32_t& latency) {
+  Log(CacheTrace::MEMORY_WRITE, -1, addr);
   if (opts_.enable_latency) {
     latency += opts_.memory_latency;
   }
-  main_memory_->WriteSpan(addr, in);
+  if (in) {
+    main_memory_->WriteSpan(addr, std::span<const uint8_t>(in, size));
+  }
 }
 
 
 void TieredCache::PrintStatistics() const {
+  // in ReplacementPolicy order
+  static constexpr const char* POLICY_NAMES[] = {"LRU", "Random", "PLRU", "BitPLRU"};
+
   std::cout << "---------- CACHE STATISTICS ----------" << std::endl;
   std::cout << std::format("Global Policies: Inclusion={}, Write={}\n",
         (opts_.inclusion_policy == InclusionPolicy::Inclusive ? "Inclusive" : "Exclusive"),
@@ -303,7 +351,7 @@ void TieredCache::PrintStatistics() const {
             level->config_.associativity,
             level->config_.line_size,
             level->config_.latency,
-            (level->config_.replacement_policy == ReplacementPolicy::LRU ? "LRU" : "Random")
+            POLICY_NAMES[static_cast<int>(level->config_.replacement_policy)]
         );
         std::cout << std::format(
             "\tAccesses: {}\n\tHits: {}\n\tMisses: {}\n\tHit Rate: {:.2f}%\n",
@@ -315,4 +363,113 @@ void TieredCache::PrintStatistics() const {
         );
   }
   std::cout << "--------------------------------------" << std::endl;
-}
\ No newline at end of file
+}
+
+void TieredCache::Flush() {
+  if (trace_) {
+    trace_->Flush();
+  }
+}
+
+std::vector<CacheStats> TieredCache::GetStatistics() const {
+  std::vector<CacheStats> stats;
+  for (const auto& level : levels_) {
+    stats.push_back(level->stats_);
+  }
+  return stats;
+}
+
+void TieredCache::SyncMemory() {
+  if (opts_.cache_model == CacheModel::Timing) {
+    return;  // memory is always up to date
+  }
+  // from the last level up, so the newest copy of a line is written last
+  for (size_t i = levels_.size(); i-- > 0;) {
+    CacheLevel* level = levels_[i].get();
+    for (uint64_t line = 0; line < level->LineNum(); ++line) {
+      if (level->Valid(line) && level->Dirty(line)) {
+        main_memory_->WriteSpan(level->GetAddr(level->Tag(line), level->GetSet(line)),
+                                {level->Data(line), level->config_.line_size});
+      }
+    }
+  }
+}
+
+void TieredCache::SaveState(std::ostream& out) {
+  using namespace Checkpoint;
+  Put<uint32_t>(out, levels_.size());
+  Put<uint8_t>(out, static_cast<uint8_t>(opts_.inclusion_policy));
+  Put<uint64_t>(out, current_cycle_);
+  for (const auto& level : levels_) {
+    Put<uint64_t>(out, level->config_.size);
+    Put<uint64_t>(out, level->config_.associativity);
+    Put<uint64_t>(out, level->config_.line_size);
+    // the timing model saves the data of its lines from memory, so that
+    // either model can restore the state
+    std::vector<uint8_t> memory_data(level->config_.line_size);
+    std::vector<uint64_t> replacement(level->config_.associativity);
+    for (uint64_t line = 0; line < level->LineNum(); ++line) {
+      uint64_t way = line % level->config_.associativity;
+      if (way == 0) {
+        level->GetReplacement(level->GetSet(line), replacement);
+      }
+      Put<uint8_t>(out, level->Valid(line) | level->Dirty(line) << 1);
+      Put<uint64_t>(out, level->Tag(line));
+      Put<uint64_t>(out, replacement[way]);
+      const uint8_t* data = level->Data(line);
+      if (!data) {
+        std::fill(memory_data.begin(), memory_data.end(), 0);
+        if (level->Valid(line)) {
+          main_memory_->ReadSpan(level->GetAddr(level->Tag(line), level->GetSet(line)), memory_data);
+        }
+        data = memory_data.data();
+      }
+      out.write(reinterpret_cast<const char*>(data), level->config_.line_size);
+    }
+  }
+}
+
+bool TieredCache::RestoreState(std::span<const uint8_t> in) {
+  using namespace Checkpoint;
+  if (Get<uint32_t>(in) != levels_.size() ||
+      Get<uint8_t>(in) != static_cast<uint8_t>(opts_.inclusion_policy)) {
+    return false;
+  }
+  uint64_t cycle = Get<uint64_t>(in);
+
+  // flags, tag and replacement word ahead of the data of every line
+  constexpr uint64_t LINE_HEADER = 1 + 2 * sizeof(uint64_t);
+  // check every level before changing any
+  std::vector<std::span<const uint8_t>> level_states;
+  for (const auto& level : levels_) {
+    const auto& config = level->config_;
+    if (Get<uint64_t>(in) != config.size ||
+        Get<uint64_t>(in) != config.associativity ||
+        Get<uint64_t>(in) != config.line_size) {
+      return false;
+    }
+    level_states.push_back(Take(in, level->LineNum() * (LINE_HEADER + config.line_size)));
+  }
+
+  current_cycle_ = cycle;
+  for (size_t i = 0; i < levels_.size(); ++i) {
+    std::span<const uint8_t> state = level_states[i];
+    CacheLevel* level = levels_[i].get();
+    std::vector<uint64_t> replacement(level->config_.associativity);
+    for (uint64_t line = 0; line < level->LineNum(); ++line) {
+      uint64_t way = line % level->config_.associativity;
+      uint8_t flags = Get<uint8_t>(state);
+      uint64_t tag = Get<uint64_t>(state);
+      replacement[way] = Get<uint64_t>(state);
+      level->SetLine(line, flags & 1, flags & 2, tag);
+      auto data = Take(state, level->config_.line_size);
+      if (level->Data(line)) {
+        std::memcpy(level->Data(line), data.data(), data.size());
+      }
+      if (way + 1 == level->config_.associativity) {
+        level->SetReplacement(level->GetSet(line), replacement);
+      }
+    }
+  }
+  return true;
+}
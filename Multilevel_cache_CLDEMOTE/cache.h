@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
 #include <fstream>
 #include <span>
 #include <stdexcept>
@@ -15,8 +16,13 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
+#include <algorithm>
+#include <bit>
+#include <random>
 
 #include "byte_addressable.h"
+#include "cache_trace.h"
 #include "options.h"
 
 inline uint32_t std_log2(uint64_t val) {
@@ -45,70 +51,24 @@ struct CacheStats {
 };
 
 // Task 1
+// copy of a line replaced by CacheLevel::Allocate, without data in the
+// timing model
 struct CacheLine {
-  bool valid = false;
   bool dirty = false;
   uint64_t tag = 0;
-  std::vector<uint8_t> data;
-  uint64_t lru_timestamp = 0;
-
-  explicit CacheLine(size_t line_size) : data(line_size, 0) {}
-};
-
-// Task 1
-class CacheSet {
- public:
-  CacheSet(size_t associativity, size_t line_size, ReplacementPolicy policy)
-      : assoc_(associativity), line_size_(line_size), replacement_policy_(policy) {
-    lines_.resize(associativity, CacheLine(line_size));
-  }
-
-  CacheLine* Find(uint64_t tag) {
-    for (auto& line : lines_) {
-      if (line.valid && line.tag == tag) {
-        return &line;
-      }
-    }
-    return nullptr;
-  }
-
-  CacheLine* FindVictim(uint64_t current_cycle) {
-    for (auto& line : lines_) {
-      if (!line.valid) {
-        return &line;
-      }
-    }
-
-    if (replacement_policy_ == ReplacementPolicy::Random) {
-      return &lines_[std::rand() % assoc_];
-    } else { // LRU
-      CacheLine* victim = &lines_[0];
-      for (size_t i = 1; i < assoc_; ++i) {
-        if (lines_[i].lru_timestamp < victim->lru_timestamp) {
-          victim = &lines_[i];
-        }
-      }
-      return victim;
-    }
-  }
-
-  void UpdateLRU(CacheLine* line, uint64_t current_cycle) {
-    if (replacement_policy_ == ReplacementPolicy::LRU) {
-      line->lru_timestamp = current_cycle;
-    }
-  }
-
- private:
-  size_t assoc_;
-  size_t line_size_;
-  ReplacementPolicy replacement_policy_;
-  std::vector<CacheLine> lines_;
+  std::unique_ptr<uint8_t[]> data;
 };
 
 // Task 1
+// line state lives in arrays indexed by set * associativity + way, so a
+// lookup only reads the tags and flags of one set, and the data of a whole
+// level is a single allocation. a level `with_data` false only keeps the
+// state, data is then null everywhere
 class CacheLevel {
  public:
-  CacheLevel(const CacheLevelConfig& config, uint64_t* cycle_ptr)
+  static constexpr uint64_t NO_LINE = UINT64_MAX;
+
+  CacheLevel(const CacheLevelConfig& config, uint64_t* cycle_ptr, bool with_data = true)
       : config_(config), current_cycle_(cycle_ptr) {
     
     offset_bits_ = std_log2(config_.line_size);
@@ -124,41 +84,172 @@ class CacheLevel {
     
     tag_bits_ = 32 - index_bits_ - offset_bits_;
 
-    sets_.resize(num_sets_, CacheSet(config_.associativity, config_.line_size, config_.replacement_policy));
+    uint64_t line_num = LineNum();
+    tags_.resize(line_num);
+    flags_.resize(line_num);
+    InitReplacement();
+    if (with_data) {
+      data_ = std::make_unique<uint8_t[]>(line_num * config_.line_size);
+    }
+    AddVictimSlot();
   }
 
-  CacheLine* Find(uint64_t addr, uint64_t* tag_out, uint64_t* index_out) {
+  // NO_LINE on a miss
+  uint64_t Find(uint64_t addr, uint64_t* tag_out, uint64_t* index_out) {
     uint64_t index = GetIndex(addr);
     uint64_t tag = GetTag(addr);
     if (tag_out) *tag_out = tag;
     if (index_out) *index_out = index;
-    return sets_[index].Find(tag);
+    uint64_t first = index * config_.associativity;
+    for (uint64_t line = first; line < first + config_.associativity; ++line) {
+      if (tags_[line] == tag && (flags_[line] & VALID)) {
+        return line;
+      }
+    }
+    return NO_LINE;
   }
 
-
-  CacheLine* Allocate(uint64_t addr, CacheLine** victim_line_out, uint64_t current_cycle) {
+  // a valid line replaced is copied to a victim slot, held until
+  // ReleaseVictim. misses in this level can nest while the victim is
+  // written back, so slots are taken in stack order and only added the
+  // first time a depth is reached
+  uint64_t Allocate(uint64_t addr, const CacheLine** victim_line_out) {
     uint64_t index = GetIndex(addr);
     uint64_t tag = GetTag(addr);
 
-    CacheLine* victim = sets_[index].FindVictim(current_cycle);
+    uint64_t victim = FindVictim(index);
 
-    if (victim->valid) {
-      *victim_line_out = new CacheLine(*victim);
+    if (Valid(victim)) {
+      if (victim_depth_ == victims_.size()) {
+        AddVictimSlot();
+      }
+      CacheLine& slot = victims_[victim_depth_++];
+      slot.dirty = Dirty(victim);
+      slot.tag = tags_[victim];
+      if (data_) {
+        std::memcpy(slot.data.get(), Data(victim), config_.line_size);
+      }
+      *victim_line_out = &slot;
     } else {
       *victim_line_out = nullptr; 
     }
 
-    victim->valid = true;
-    victim->dirty = false;
-    victim->tag = tag;
-    UpdateLRU(victim, current_cycle);
+    Fill(victim, tag);
+    Touch(victim);
     
     return victim;
   }
 
-  void UpdateLRU(CacheLine* line, uint64_t current_cycle) {
-    if (config_.replacement_policy == ReplacementPolicy::LRU) {
-      line->lru_timestamp = current_cycle;
+  void ReleaseVictim() { victim_depth_--; }
+
+  // replacement state update for a use of `line`
+  void Touch(uint64_t line) {
+    uint64_t set = line / config_.associativity;
+    uint32_t way = line - set * config_.associativity;
+    switch (config_.replacement_policy) {
+      case ReplacementPolicy::LRU:
+        MoveToFront(set, way);
+        break;
+      case ReplacementPolicy::PLRU:
+        // point every node on the path away from the way
+        for (uint64_t node = config_.associativity + way; node > 1; node >>= 1) {
+          if (node & 1) {
+            plru_bits_[set] &= ~(uint64_t(1) << (node >> 1));
+          } else {
+            plru_bits_[set] |= uint64_t(1) << (node >> 1);
+          }
+        }
+        break;
+      case ReplacementPolicy::BitPLRU:
+        plru_bits_[set] |= uint64_t(1) << way;
+        if (plru_bits_[set] == FullMask()) {
+          plru_bits_[set] = uint64_t(1) << way;
+        }
+        break;
+      case ReplacementPolicy::Random:
+        break;
+    }
+  }
+
+  bool Valid(uint64_t line) const { return flags_[line] & VALID; }
+  bool Dirty(uint64_t line) const { return flags_[line] & DIRTY; }
+  uint64_t Tag(uint64_t line) const { return tags_[line]; }
+  // `config_.line_size` bytes
+  uint8_t* Data(uint64_t line) {
+    return data_ ? data_.get() + line * config_.line_size : nullptr;
+  }
+  // valid and clean, holding `tag`
+  void Fill(uint64_t line, uint64_t tag) {
+    flags_[line] = VALID;
+    tags_[line] = tag;
+  }
+  // the dirty bit survives invalidation unless cleared as well
+  void Invalidate(uint64_t line) { flags_[line] &= ~VALID; }
+  void SetDirty(uint64_t line, bool dirty) {
+    flags_[line] = dirty ? flags_[line] | DIRTY : flags_[line] & ~DIRTY;
+  }
+  // checkpoint restore only
+  void SetLine(uint64_t line, bool valid, bool dirty, uint64_t tag) {
+    flags_[line] = (valid ? VALID : 0) | (dirty ? DIRTY : 0);
+    tags_[line] = tag;
+  }
+
+  // replacement state of a set as one word per way, as checkpoints keep
+  // it: the recency for lru, larger meaning more recently used, the MRU
+  // bit for bitplru, and for plru tree node n in way n. any words give a
+  // usable state, so a checkpoint of another policy is only less accurate
+  void GetReplacement(uint64_t set, std::span<uint64_t> words) const {
+    std::fill(words.begin(), words.end(), 0);
+    uint64_t base = set * config_.associativity;
+    switch (config_.replacement_policy) {
+      case ReplacementPolicy::LRU: {
+        uint64_t recency = 0;
+        for (uint32_t way = lru_tail_[set]; way != NO_WAY; way = lru_prev_[base + way]) {
+          words[way] = recency++;
+        }
+        break;
+      }
+      case ReplacementPolicy::PLRU:
+      case ReplacementPolicy::BitPLRU:
+        for (uint32_t way = 0; way < config_.associativity; ++way) {
+          words[way] = plru_bits_[set] >> way & 1;
+        }
+        break;
+      case ReplacementPolicy::Random:
+        break;
+    }
+  }
+
+  void SetReplacement(uint64_t set, std::span<const uint64_t> words) {
+    switch (config_.replacement_policy) {
+      case ReplacementPolicy::LRU: {
+        // least recent first, ties to the lower way
+        std::vector<uint32_t> order(config_.associativity);
+        for (uint32_t way = 0; way < order.size(); ++way) {
+          order[way] = way;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+          return words[a] < words[b];
+        });
+        for (uint32_t way : order) {
+          MoveToFront(set, way);
+        }
+        break;
+      }
+      case ReplacementPolicy::PLRU:
+      case ReplacementPolicy::BitPLRU:
+        plru_bits_[set] = 0;
+        for (uint32_t way = 0; way < config_.associativity; ++way) {
+          plru_bits_[set] |= uint64_t(words[way] != 0) << way;
+        }
+        plru_bits_[set] &= FullMask();
+        if (config_.replacement_policy == ReplacementPolicy::BitPLRU &&
+            plru_bits_[set] == FullMask()) {
+          plru_bits_[set] = 0;
+        }
+        break;
+      case ReplacementPolicy::Random:
+        break;
     }
   }
 
@@ -179,8 +270,124 @@ class CacheLevel {
     return (tag << (index_bits_ + offset_bits_)) | (index << offset_bits_);
   }
 
+  uint64_t LineNum() const { return num_sets_ * config_.associativity; }
+  uint64_t GetSet(uint64_t line) const { return line / config_.associativity; }
+
  private:
-  std::vector<CacheSet> sets_;
+  static constexpr uint8_t VALID = 1;
+  static constexpr uint8_t DIRTY = 2;
+  static constexpr uint32_t NO_WAY = UINT32_MAX;
+
+  void InitReplacement() {
+    uint64_t assoc = config_.associativity;
+    switch (config_.replacement_policy) {
+      case ReplacementPolicy::LRU:
+        // from the last way down to way 0 as the least recently used, the
+        // order timestamps all equal would give
+        lru_prev_.resize(LineNum());
+        lru_next_.resize(LineNum());
+        lru_head_.assign(num_sets_, assoc - 1);
+        lru_tail_.assign(num_sets_, 0);
+        for (uint64_t set = 0; set < num_sets_; ++set) {
+          for (uint32_t way = 0; way < assoc; ++way) {
+            lru_prev_[set * assoc + way] = way + 1 < assoc ? way + 1 : NO_WAY;
+            lru_next_[set * assoc + way] = way > 0 ? way - 1 : NO_WAY;
+          }
+        }
+        break;
+      case ReplacementPolicy::PLRU:
+        if (assoc & (assoc - 1)) {
+          throw std::runtime_error("Tree PLRU needs a power of 2 associativity.");
+        }
+        [[fallthrough]];
+      case ReplacementPolicy::BitPLRU:
+        if (assoc > 64) {
+          throw std::runtime_error("PLRU supports an associativity of at most 64.");
+        }
+        plru_bits_.assign(num_sets_, 0);
+        break;
+      case ReplacementPolicy::Random:
+        break;
+    }
+  }
+
+  uint64_t FullMask() const {
+    return config_.associativity == 64 ? ~uint64_t(0)
+                                       : (uint64_t(1) << config_.associativity) - 1;
+  }
+
+  void MoveToFront(uint64_t set, uint32_t way) {
+    uint32_t head = lru_head_[set];
+    if (head == way) {
+      return;
+    }
+    uint64_t base = set * config_.associativity;
+    // not the head, so there is a previous way
+    uint32_t prev = lru_prev_[base + way];
+    uint32_t next = lru_next_[base + way];
+    lru_next_[base + prev] = next;
+    if (next == NO_WAY) {
+      lru_tail_[set] = prev;
+    } else {
+      lru_prev_[base + next] = prev;
+    }
+    lru_prev_[base + way] = NO_WAY;
+    lru_next_[base + way] = head;
+    lru_prev_[base + head] = way;
+    lru_head_[set] = way;
+  }
+
+  void AddVictimSlot() {
+    victims_.push_back({false, 0, data_ ? std::make_unique<uint8_t[]>(config_.line_size) : nullptr});
+  }
+
+  uint64_t FindVictim(uint64_t index) {
+    uint64_t first = index * config_.associativity;
+    uint64_t last = first + config_.associativity;
+    for (uint64_t line = first; line < last; ++line) {
+      if (!Valid(line)) {
+        return line;
+      }
+    }
+
+    switch (config_.replacement_policy) {
+      case ReplacementPolicy::Random:
+        return first + rng_() % config_.associativity;
+      case ReplacementPolicy::PLRU: {
+        // follow the bits down to a leaf
+        uint64_t node = 1;
+        while (node < config_.associativity) {
+          node = 2 * node + (plru_bits_[index] >> node & 1);
+        }
+        return first + node - config_.associativity;
+      }
+      case ReplacementPolicy::BitPLRU:
+        // never all set, but for a single way
+        return first + std::min<uint64_t>(std::countr_zero(~plru_bits_[index]),
+                                          config_.associativity - 1);
+      default:  // LRU
+        return first + lru_tail_[index];
+    }
+  }
+
+  std::vector<uint64_t> tags_;
+  std::vector<uint8_t> flags_;
+  // replacement state. lru links the ways of every set from the most
+  // recently used at lru_head_ to the least at lru_tail_. plru keeps the
+  // tree bits of a set in one word, node n with children 2n and 2n + 1 and
+  // set for a victim on the right, bitplru the MRU bits of its ways
+  std::vector<uint32_t> lru_prev_;
+  std::vector<uint32_t> lru_next_;
+  std::vector<uint32_t> lru_head_;
+  std::vector<uint32_t> lru_tail_;
+  std::vector<uint64_t> plru_bits_;
+  // random victims, seeded the same in every level so runs repeat and
+  // caches in different threads do not share a generator
+  std::minstd_rand rng_;
+  std::unique_ptr<uint8_t[]> data_;
+  // a deque keeps slots in place while outer misses still use them
+  std::deque<CacheLine> victims_;
+  size_t victim_depth_ = 0;
   uint64_t* current_cycle_;
 };
 
@@ -191,25 +398,19 @@ class TieredCache : public ByteAddressable {
       : opts_(opts), main_memory_(std::move(main_memory)), current_cycle_(0), last_access_latency_(0) {
     
     for (const auto& config : opts.cache_levels) {
-      levels_.push_back(std::make_unique<CacheLevel>(config, &current_cycle_));
+      levels_.push_back(std::make_unique<CacheLevel>(
+          config, &current_cycle_, opts.cache_model == CacheModel::Functional));
     }
 
     if (opts.enable_trace) {
-      trace_file_.open(opts.trace_output_file);
-    }
-  }
-
-  ~TieredCache() {
-    if (opts_.enable_cache) {
-      PrintStatistics();
-    }
-    if (trace_file_.is_open()) {
-      trace_file_.close();
+      trace_ = std::make_unique<CacheTrace>(opts.trace_output_file);
     }
   }
 
   void ReadSpan(uint32_t addr, std::span<uint8_t> out) override;
   void WriteSpan(uint32_t addr, std::span<const uint8_t> in) override;
+  // timing model only, an access whose data the caller takes from memory
+  void Access(uint32_t addr, uint32_t size, bool write);
 
   // Task 2
   void Demote(uint32_t addr);
@@ -219,25 +420,41 @@ class TieredCache : public ByteAddressable {
 
   // Task 4
   void PrintStatistics() const;
+  // write out the buffered trace events, needed before exit()
+  void Flush();
+  // statistics of every level, L1 first
+  std::vector<CacheStats> GetStatistics() const;
+
+  // checkpoint support, none of it counts as an access
+  // write dirty data down to memory but keep the lines dirty, so memory
+  // alone holds what the program sees
+  void SyncMemory();
+  void SaveState(std::ostream& out);
+  // false, leaving the cache untouched, if the state is for another geometry
+  bool RestoreState(std::span<const uint8_t> in);
 
  private:  
-  void HandleRead(size_t level_idx, uint64_t addr, std::span<uint8_t> out, uint32_t& latency, bool is_write_alloc = false);
+  // `out`, `in` and `data` are null in the timing model, and `out` for a
+  // write-allocate, then nothing is copied
+  void HandleRead(size_t level_idx, uint64_t addr, uint64_t size, uint8_t* out, uint32_t& latency, bool is_write_alloc = false);
   
-  void HandleWrite(size_t level_idx, uint64_t addr, std::span<const uint8_t> in, uint32_t& latency);
+  void HandleWrite(size_t level_idx, uint64_t addr, uint64_t size, const uint8_t* in, uint32_t& latency);
 
-  void Evict(size_t level_idx, CacheLine* victim_line, uint64_t victim_addr, uint32_t& latency);
+  void Evict(size_t level_idx, bool dirty, const uint8_t* data, uint64_t victim_addr, uint32_t& latency);
 
   void BackInvalidate(int level_idx, uint64_t addr);
 
   void InvalidateInLowerLevels(size_t level_idx, uint64_t addr);
 
-  void ReadFromMemory(uint64_t addr, std::span<uint8_t> out, uint32_t& latency);
-  void WriteToMemory(uint64_t addr, std::span<const uint8_t> in, uint32_t& latency);
+  void ReadFromMemory(uint64_t addr, uint64_t size, uint8_t* out, uint32_t& latency);
+  void WriteToMemory(uint64_t addr, uint64_t size, const uint8_t* in, uint32_t& latency);
 
   // Task 4
-  void Log(const std::string& message) {
-    if (trace_file_.is_open()) {
-      trace_file_ << std::format("[Cycle {}] ", current_cycle_) << message << std::endl;
+  // every access logs, so nothing but the check happens without a trace.
+  // `level_idx` is that of the level, or -1 for no level
+  void Log(CacheTrace::Kind kind, int level_idx, uint64_t addr = 0) {
+    if (trace_) [[unlikely]] {
+      trace_->Record(current_cycle_, kind, level_idx + 1, addr);
     }
   }
 
@@ -247,7 +464,7 @@ class TieredCache : public ByteAddressable {
 
   uint64_t current_cycle_;
   uint32_t last_access_latency_;
-  std::ofstream trace_file_;
+  std::unique_ptr<CacheTrace> trace_;
 };
 
 #endif
\ No newline at end of file
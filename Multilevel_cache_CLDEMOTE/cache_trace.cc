@@ -0,0 +1,120 @@
+#include "cache_trace.h"
+
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <stdexcept>
+
+CacheTrace::CacheTrace(const std::string& path)
+    : out_(path, std::ios::binary), path_(path) {
+  if (!out_) {
+    throw std::runtime_error(std::format("Cannot write {}\n", path));
+  }
+  out_.write(MAGIC, sizeof(MAGIC));
+}
+
+CacheTrace::~CacheTrace() {
+  // too late to report errors
+  out_.write(reinterpret_cast<const char*>(buf_.data()), pos_ * sizeof(Event));
+}
+
+void CacheTrace::Flush() {
+  out_.write(reinterpret_cast<const char*>(buf_.data()), pos_ * sizeof(Event));
+  out_.flush();
+  pos_ = 0;
+  if (!out_) {
+    throw std::runtime_error(std::format("Cannot write {}\n", path_));
+  }
+}
+
+std::string CacheTrace::Format(const Event& event) {
+  std::string line = std::format("[Cycle {}] ", event.cycle);
+  auto out = std::back_inserter(line);
+  uint32_t level = event.level;
+  uint32_t addr = event.addr;
+  switch (event.kind) {
+    case READ_HIT:
+      std::format_to(out, "L{} Read Hit: addr=0x{:x}", level, addr);
+      break;
+    case READ_MISS:
+      std::format_to(out, "L{} Read Miss: addr=0x{:x}", level, addr);
+      break;
+    case WRITE_HIT:
+      std::format_to(out, "L{} Write Hit: addr=0x{:x}", level, addr);
+      break;
+    case WRITE_MISS:
+      std::format_to(out, "L{} Write Miss: addr=0x{:x}", level, addr);
+      break;
+    case WRITE_ALLOCATE:
+      std::format_to(out,
+                     "L{} Write-Allocate complete, performing write: "
+                     "addr=0x{:x}",
+                     level, addr);
+      break;
+    case INCLUSIVE_BACK_INVALIDATE:
+      std::format_to(out, "L{} Inclusive Back-Invalidate: addr=0x{:x}", level,
+                     addr);
+      break;
+    case EVICT_CLEAN:
+    case EVICT_DIRTY:
+      std::format_to(out, "L{} Evict: addr=0x{:x} (Dirty={})", level, addr,
+                     event.kind == EVICT_DIRTY);
+      break;
+    case WRITE_BACK:
+      std::format_to(out, "L{} Write-Back: addr=0x{:x}", level, addr);
+      break;
+    case EXCLUSIVE_PUSH_DOWN:
+      std::format_to(out, "L{} Exclusive Push-Down: addr=0x{:x}", level, addr);
+      break;
+    case BACK_INVALIDATED:
+      std::format_to(out, "L{} Back-Invalidated: addr=0x{:x}", level, addr);
+      break;
+    case EXCLUSIVE_INVALIDATE:
+      std::format_to(out, "L{} Exclusive Invalidate: addr=0x{:x}", level, addr);
+      break;
+    case DEMOTE:
+      std::format_to(out, "CLDEMOTE: addr=0x{:x}", addr);
+      break;
+    case DEMOTE_MISS:
+      line += "CLDEMOTE: L1 Miss, no action.";
+      break;
+    case DEMOTE_INCLUSIVE:
+      line += "CLDEMOTE: Inclusive policy, evicting from L1.";
+      break;
+    case DEMOTE_EXCLUSIVE:
+      line += "CLDEMOTE: Exclusive policy, moving from L1 to L2.";
+      break;
+    case MEMORY_READ:
+      std::format_to(out, "Memory Read: addr=0x{:x}", addr);
+      break;
+    case MEMORY_WRITE:
+      std::format_to(out, "Memory Write: addr=0x{:x}", addr);
+      break;
+    default:
+      throw std::runtime_error(
+          std::format("Unknown cache trace event {}\n", event.kind));
+  }
+  return line;
+}
+
+CacheTraceReader::CacheTraceReader(const std::string& path)
+    : file_(path), in_(file_.Data()) {
+  if (in_.size() < sizeof(CacheTrace::MAGIC) ||
+      std::memcmp(in_.data(), CacheTrace::MAGIC,
+                  sizeof(CacheTrace::MAGIC)) != 0) {
+    throw std::runtime_error(std::format("{} is not a cache trace\n", path));
+  }
+  in_ = in_.subspan(sizeof(CacheTrace::MAGIC));
+}
+
+bool CacheTraceReader::Next(CacheTrace::Event& event) {
+  if (in_.empty()) {
+    return false;
+  }
+  if (in_.size() < sizeof(event)) {
+    throw std::runtime_error("Truncated cache trace\n");
+  }
+  std::memcpy(&event, in_.data(), sizeof(event));
+  in_ = in_.subspan(sizeof(event));
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef SRC_CACHE_TRACE_H
+#define SRC_CACHE_TRACE_H
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+
+#include "checkpoint.h"
+
+// binary trace of the cache hierarchy events, written through a buffer of
+// fixed-size records after MAGIC. tools/cache_trace_format.cc turns it
+// into text
+class CacheTrace {
+ public:
+  enum Kind : uint8_t {
+    READ_HIT,
+    READ_MISS,
+    WRITE_HIT,
+    WRITE_MISS,
+    WRITE_ALLOCATE,
+    INCLUSIVE_BACK_INVALIDATE,
+    EVICT_CLEAN,
+    EVICT_DIRTY,
+    WRITE_BACK,
+    EXCLUSIVE_PUSH_DOWN,
+    BACK_INVALIDATED,
+    EXCLUSIVE_INVALIDATE,
+    DEMOTE,
+    DEMOTE_MISS,
+    DEMOTE_INCLUSIVE,
+    DEMOTE_EXCLUSIVE,
+    MEMORY_READ,
+    MEMORY_WRITE,
+    KIND_NUM,
+  };
+
+  static constexpr char MAGIC[8] = {'R', 'V', 'C', 'T', 'R', 'C', '0', '1'};
+
+  struct Event {
+    uint64_t cycle = 0;
+    uint32_t addr = 0;
+    // 1 for L1, 0 for events of no level
+    uint8_t level = 0;
+    uint8_t kind = 0;
+    uint16_t unused = 0;
+  };
+  static_assert(sizeof(Event) == 16);
+
+ private:
+  static constexpr uint32_t BUFFER_NUM = 1 << 12;
+
+  std::ofstream out_;
+  std::string path_;
+  std::array<Event, BUFFER_NUM> buf_;
+  uint32_t pos_ = 0;
+
+ public:
+  explicit CacheTrace(const std::string& path);
+  // events not flushed yet are written, but failures go unnoticed
+  ~CacheTrace();
+  CacheTrace(const CacheTrace&) = delete;
+  CacheTrace& operator=(const CacheTrace&) = delete;
+
+  void Record(uint64_t cycle, Kind kind, uint32_t level, uint64_t addr) {
+    if (pos_ == BUFFER_NUM) {
+      Flush();
+    }
+    buf_[pos_++] = {cycle, static_cast<uint32_t>(addr),
+                    static_cast<uint8_t>(level), kind};
+  }
+
+  // write out the buffered events
+  void Flush();
+
+  // one line of text, as the cache trace used to be written
+  static std::string Format(const Event& event);
+};
+
+// reads back a trace written by CacheTrace, mapped in whole
+class CacheTraceReader {
+  Checkpoint::MappedFile file_;
+  std::span<const uint8_t> in_;
+
+ public:
+  explicit CacheTraceReader(const std::string& path);
+
+  // false at the end of the trace
+  bool Next(CacheTrace::Event& event);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SRC_CHECKPOINT_H
+#define SRC_CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// checkpoint files hold plain host-endian fields. they are written through
+// a stream and read back from a read-only mapping of the whole file
+namespace Checkpoint {
+
+inline constexpr char MAGIC[8] = {'R', 'V', 'C', 'K', 'P', 'T', '0', '1'};
+// a shared image is IMAGE_MAGIC, the length and bytes of a string naming
+// what it was built from, then a checkpoint
+inline constexpr char IMAGE_MAGIC[8] = {'R', 'V', 'I', 'M', 'A', 'G', '0', '1'};
+
+template <typename T>
+void Put(std::ostream& out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// split the first `len` bytes off `in`
+inline std::span<const uint8_t> Take(std::span<const uint8_t>& in,
+                                     std::size_t len) {
+  if (in.size() < len) {
+    throw std::runtime_error("Truncated checkpoint\n");
+  }
+  auto head = in.first(len);
+  in = in.subspan(len);
+  return head;
+}
+
+template <typename T>
+T Get(std::span<const uint8_t>& in) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T value;
+  std::memcpy(&value, Take(in, sizeof(T)).data(), sizeof(T));
+  return value;
+}
+
+// read-only mapping of a whole file, also used for access traces
+class MappedFile {
+  const uint8_t* data_ = nullptr;
+  std::size_t size_ = 0;
+
+ public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::span<const uint8_t> Data() const { return {data_, size_}; }
+};
+
+}  // namespace Checkpoint
+
+#endif
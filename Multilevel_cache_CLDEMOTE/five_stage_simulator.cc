@@ -4,6 +4,7 @@
 #include <cstring>
 #include <format>
 #include <fstream>
+#include <limits>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
@@ -17,68 +18,101 @@
 
 using namespace RISCV;
 
-void FiveStageSimulator::Run() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Run() {
+  history_.reg_base = regs_;
+
   // Main Simulation Loop
   while (true) {
-    if (regs_[0] != 0) {
-      Panic("Register 0's value is not zero!\n");
-    }
-    if (regs_[REG_SP] < stack_base_ - stack_size_) {
-      Panic("Stack Overflow!\n");
-    }
+    Cycle();
+  }
+}
 
-    // handle branch recoveries
-    if (should_recover_branch_) {
-      if (verbose_)
-        printf("branch recovery: new pc 0x%08lx\n", branch_next_pc_);
+template <typename Policy>
+uint64_t FiveStageSimulator<Policy>::SimulateInsts(uint64_t n) {
+  // start the history over, states before were not recorded
+  history_.inst_record.Clear();
+  history_.reg_record.Clear();
+  history_.reg_base = regs_;
+
+  uint64_t first_cycle = history_.cycle_count;
+  inst_limit_ = history_.inst_count + n;
+  // run until the last instruction has written back, younger ones wait
+  // in execute and are squashed below
+  while (history_.inst_count != inst_limit_ || mem_op_ != nullptr ||
+         wb_op_ != nullptr || should_recover_branch_) {
+    Cycle();
+  }
+  inst_limit_ = std::numeric_limits<uint64_t>::max();
 
-      pc_ = branch_next_pc_;
-      should_recover_branch_ = false;
-      branch_next_pc_ = 0;
+  if (execute_op_ != nullptr) {
+    pc_ = execute_op_->pc;
+  } else if (decode_op_ != nullptr) {
+    pc_ = decode_op_->pc;
+  }
+  ReleaseOp(execute_op_);
+  ReleaseOp(decode_op_);
+  wait_for_branch_ = false;
+  return history_.cycle_count - first_cycle;
+}
 
-      wait_for_branch_ = false;
-    }
+template <typename Policy>
+void FiveStageSimulator<Policy>::Cycle() {
+  if (regs_[0] != 0) {
+    Panic("Register 0's value is not zero!\n");
+  }
+  if (regs_[REG_SP] < stack_base_ - stack_size_) {
+    Panic("Stack Overflow!\n");
+  }
 
-    // clean data hazard
-    wait_for_data_ = false;
-    data_hazard_execute_op_dest_ = -1;
-    data_hazard_mem_op_dest_ = -1;
-    data_hazard_wb_op_dest_ = -1;
-
-    // DO NOT CHANGE the execution order below
-    WriteBack();
-    MemoryAccess();
-    Execute();
-    Decode();
-    Fetch();
-
-    history_.cycle_count++;
-    history_.reg_record.push_back(GetRegInfoStr());
-    if (history_.reg_record.size() >= 100000) {  // Avoid using up memory
-      history_.reg_record.clear();
-      history_.inst_record.clear();
-    }
+  // handle branch recoveries
+  if (should_recover_branch_) {
+    if (Verbose())
+      printf("branch recovery: new pc 0x%08lx\n", branch_next_pc_);
 
-    if (verbose_) {
-      std::cout << GetRegInfoStr();
-    }
+    pc_ = branch_next_pc_;
+    should_recover_branch_ = false;
+    branch_next_pc_ = 0;
+
+    wait_for_branch_ = false;
+  }
+
+  // clean data hazard
+  wait_for_data_ = false;
+  data_hazard_execute_op_dest_ = -1;
+  data_hazard_mem_op_dest_ = -1;
+  data_hazard_wb_op_dest_ = -1;
+
+  // DO NOT CHANGE the execution order below
+  WriteBack();
+  MemoryAccess();
+  Execute();
+  Decode();
+  Fetch();
+
+  history_.cycle_count++;
+  RecordCycle();
 
-    if (single_step_) {
-      // printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
-      char ch;
-      while ((ch = getchar()) != '\n') {
-        if (ch == 'd') {
-          DumpHistory();
-        }
+  if (Verbose()) {
+    std::cout << GetRegInfoStr(pc_, regs_);
+  }
+
+  if (SingleStep()) {
+    // printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
+    char ch;
+    while ((ch = getchar()) != '\n') {
+      if (ch == 'd') {
+        DumpHistory();
       }
     }
   }
 }
 
-void FiveStageSimulator::Fetch() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Fetch() {
   // control hazard
   if (true == wait_for_branch_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("control hazard at fetch\n");
     }
     // debug information
@@ -88,7 +122,7 @@ void FiveStageSimulator::Fetch() {
 
   /* if pipeline is stalled (our output slot is not empty), return */
   if (decode_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Fetch: stalled at fetch\n");
     }
     return;
@@ -96,7 +130,7 @@ void FiveStageSimulator::Fetch() {
 
   // Task 3: 
   if (mem_access_stall_remaining_ > 0) {
-      if (verbose_) {
+      if (Verbose()) {
           printf("Fetch: Stalled for memory access\n");
       }
       return;
@@ -107,22 +141,23 @@ void FiveStageSimulator::Fetch() {
   }
 
   /* Allocate an op and send it down the pipeline. */
-  auto op = std::make_unique<PipeOp>();
-  op->inst = memory_->GetInt(pc_);
-  if (verbose_) {
+  auto* op = AllocOp();
+  op->inst = memory_->FetchInst(pc_);
+  if (Verbose()) {
     printf("Fetched instruction 0x%.8x at address 0x%lx\n", op->inst, pc_);
   }
   op->pc = pc_;
-  decode_op_ = std::move(op);
+  decode_op_ = op;
 
   /* update PC */
   pc_ += 4;
 }
 
-void FiveStageSimulator::Decode() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Decode() {
   /* if no op to decode, return */
   if (decode_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("decode: Bubble\n");
     }
     return;
@@ -130,41 +165,41 @@ void FiveStageSimulator::Decode() {
 
   // Task 3:
   if (mem_access_stall_remaining_ > 0) {
-      if (verbose_) {
+      if (Verbose()) {
           printf("Decode: Stalled for memory access\n");
       }
       return;
   }
 
-  auto* op = decode_op_.get();
+  auto* op = decode_op_;
   if (op->pc_len != 4) {
     Panic(
         "Current implementation does not support 16bit RV64C instructions!\n");
   }
   try {
-    DecodeInst(op, regs_);
+    const DecodedInst& decoded = decode_cache_.Lookup(op->pc, op->inst);
+    DecodeInst(op, decoded, regs_);
   } catch (const std::exception& e) {
     Panic(e.what());
   }
 
-  history_.inst_record.emplace_back(
-      std::format("{:#010x}: {}\n", op->pc, op->inst_str));
+  history_.inst_record.Push({op->pc, op->inst, history_.reg_record.Pushed()});
 
   /* if downstream stall or occur data hazard, return
    * (and leave any input we had)
    */
   if (execute_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       std::cout << std::format(
           "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-          op->pc, op->inst_str);
+          op->pc, DisassembleInst(op->inst));
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Decoded instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   // data hazard detect at last to show inststr
@@ -176,7 +211,7 @@ void FiveStageSimulator::Decode() {
             rs == data_hazard_mem_op_dest_ || rs == data_hazard_wb_op_dest_);
   };
   if (wait_for_data(op->rs1) || wait_for_data(op->rs2)) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("\tstalled at decode for data hazard\n");
     }
     // debug information
@@ -188,14 +223,15 @@ void FiveStageSimulator::Decode() {
   wait_for_branch_ = IsBranch(op->inst_type) || IsJump(op->inst_type);
 
   /* place op in downstream slot */
-  execute_op_ = std::move(decode_op_);
+  execute_op_ = decode_op_;
   decode_op_ = nullptr;
 }
 
-void FiveStageSimulator::Execute() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::Execute() {
   /* if no op to execute, return */
   if (execute_op_ == nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Execute: Bubble\n");
     }
     return;
@@ -203,30 +239,39 @@ void FiveStageSimulator::Execute() {
 
   // Task 3
   if (mem_access_stall_remaining_ > 0) {
-      if (verbose_) {
+      if (Verbose()) {
           printf("Execute: Stalled for memory access\n");
       }
       return;
   }
 
-  auto* op = execute_op_.get();
+  auto* op = execute_op_;
 
   /* if downstream stall, return (and leave any input we had) */
   if (mem_op_ != nullptr) {
-    if (verbose_) {
+    if (Verbose()) {
+      printf("Execute: Stall\n");
+    }
+    return;
+  }
+  // the instruction limit of SimulateInsts is reached
+  if (history_.inst_count == inst_limit_) {
+    if (Verbose()) {
       printf("Execute: Stall\n");
     }
     return;
   }
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "Execute instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
   history_.inst_count++;
 
   try {
     bool exit_ctrl = false;
+    // system calls may access memory
+    memory_->SetAccessPc(op->pc);
     ExecuteInst(op, &exit_ctrl, memory_.get());
     if (exit_ctrl) {
       printf("Program exit from an exit() system call\n");
@@ -235,6 +280,7 @@ void FiveStageSimulator::Execute() {
         DumpHistory();
       }
       PrintStatistics();
+      FlushTrace();
       exit(0);
     }
   } catch (const std::exception& e) {
@@ -252,21 +298,22 @@ void FiveStageSimulator::Execute() {
   data_hazard_execute_op_dest_ = op->dest_reg;
 
   /* remove from upstream stage and place in downstream stage */
-  mem_op_ = std::move(execute_op_);
+  mem_op_ = execute_op_;
   execute_op_ = nullptr;
 }
 
-void FiveStageSimulator::MemoryAccess() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::MemoryAccess() {
   if (mem_access_stall_remaining_ > 0) {
     mem_access_stall_remaining_--;
-    if (verbose_) {
+    if (Verbose()) {
       printf("Memory Access: Stalled for latency (%d cycles remaining)\n", mem_access_stall_remaining_);
     }
     
     if (mem_access_stall_remaining_ == 0) {
         // data hazard for decode to detect
         data_hazard_mem_op_dest_ = mem_op_->dest_reg;
-        wb_op_ = std::move(mem_op_);
+        wb_op_ = mem_op_;
         mem_op_ = nullptr;
     }
     
@@ -274,84 +321,38 @@ void FiveStageSimulator::MemoryAccess() {
   }
 
   if (!mem_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("Memory Access: Bubble\n");
     }
     return;
   }
 
-  PipeOp* op = mem_op_.get();
+  PipeOp* op = mem_op_;
 
-  const int64_t& op2 = op->op2;
   const RegId& dest_reg = op->dest_reg;
-  int64_t& out = op->out;
+  const int64_t addr = op->out;
   const bool write_mem = op->write_mem;
   const bool read_mem = op->read_mem;
-  const bool read_sign_ext = op->read_sign_ext;
   const uint32_t mem_len = op->mem_len;
 
-  if (verbose_) {
+  if (Verbose()) {
     std::cout << std::format(
         "MemoryAccess instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   // Task 3
   data_hazard_mem_op_dest_ = dest_reg;
 
+  try {
+    memory_->SetAccessPc(op->pc);
+    MemoryAccessInst(op, memory_.get());
+  } catch (const std::exception& e) {
+    Panic(e.what());
+  }
   if (write_mem) {
-    switch (mem_len) {
-      case 1:
-        memory_->SetByte(out, op2);
-        break;
-      case 2:
-        memory_->SetShort(out, op2);
-        break;
-      case 4:
-        memory_->SetInt(out, op2);
-        break;
-      case 8:
-        memory_->SetLong(out, op2);
-        break;
-      default:
-        Panic("Unknown memLen %d\n", mem_len);
-    }
-   }
-  
-
-  if (read_mem) {
-    switch (mem_len) {
-      case 1:
-        if (read_sign_ext) {
-          out = (int64_t)SEXT<8>(memory_->GetByte(out));
-        } else {
-          out = (uint64_t)memory_->GetByte(out);
-        }
-        break;
-      case 2:
-        if (read_sign_ext) {
-          out = (int64_t)SEXT<16>(memory_->GetShort(out));
-        } else {
-          out = (uint64_t)memory_->GetShort(out);
-        }
-        break;
-      case 4:
-        if (read_sign_ext) {
-          out = (int64_t)SEXT<32>(memory_->GetInt(out));
-        } else {
-          out = (uint64_t)memory_->GetInt(out);
-        }
-        break;
-      case 8:
-        if (read_sign_ext) {
-          out = (int64_t)memory_->GetLong(out);
-        } else {
-          out = (uint64_t)memory_->GetLong(out);
-        }
-        break;
-      default:
-        Panic("Unknown memLen %d\n", mem_len);
-    }
+    // self-modifying code must not hit stale decodes
+    decode_cache_.Invalidate(addr, mem_len);
   }
 
   // Task 3
@@ -359,7 +360,7 @@ void FiveStageSimulator::MemoryAccess() {
     uint32_t latency = memory_->GetLastAccessLatency();
     if (latency > 1) {
       mem_access_stall_remaining_ = latency - 1;
-      if (verbose_) {
+      if (Verbose()) {
         printf("Memory Access: Initiating stall for %d cycles (total %d)\n", mem_access_stall_remaining_, latency);
       }
       
@@ -368,14 +369,15 @@ void FiveStageSimulator::MemoryAccess() {
   }
 
   /* clear stage input and transfer to next stage */
-  wb_op_ = std::move(mem_op_);
+  wb_op_ = mem_op_;
   mem_op_ = nullptr;
 }
 
-void FiveStageSimulator::WriteBack() {
+template <typename Policy>
+void FiveStageSimulator<Policy>::WriteBack() {
   /* if there is no instruction in this pipeline stage, we are done */
   if (!wb_op_) {
-    if (verbose_) {
+    if (Verbose()) {
       printf("WriteBack: Bubble\n");
     }
     return;
@@ -383,11 +385,11 @@ void FiveStageSimulator::WriteBack() {
   // no situation to stall
 
   /* grab the op out of our input slot */
-  PipeOp* op = wb_op_.get();
-  if (verbose_) {
+  PipeOp* op = wb_op_;
+  if (Verbose()) {
     std::cout << std::format(
         "WriteBack instruction {:#010x} at address {:#x} as {}\n", op->inst,
-        op->pc, op->inst_str);
+        op->pc, DisassembleInst(op->inst));
   }
 
   /* if this instruction writes a register, do so now */
@@ -395,17 +397,35 @@ void FiveStageSimulator::WriteBack() {
   const RegId& dest_reg = op->dest_reg;
   if (dest_reg > 0) {
     regs_[dest_reg] = op->out;
+    history_.wb_reg = dest_reg;
+    history_.wb_value = op->out;
   }
 
   // data hazard for decode to detect
   data_hazard_wb_op_dest_ = dest_reg;
 
-  /* free the op automatically with unique_ptr */
-  wb_op_.reset();
-  wb_op_ = nullptr;
+  /* return the op to the pool */
+  ReleaseOp(wb_op_);
 }
 
-void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
+template <typename Policy>
+PipeOp* FiveStageSimulator<Policy>::AllocOp() {
+  assert(free_op_num_ > 0);
+  auto* op = free_ops_[--free_op_num_];
+  *op = PipeOp{};
+  return op;
+}
+
+template <typename Policy>
+void FiveStageSimulator<Policy>::ReleaseOp(PipeOp*& op) {
+  if (op != nullptr) {
+    free_ops_[free_op_num_++] = op;
+    op = nullptr;
+  }
+}
+
+template <typename Policy>
+void FiveStageSimulator<Policy>::PipeRecover(uint32_t dest_pc) {
   /* if there is already a recovery scheduled, it must have come from a later
    * stage (which executes older instructions), hence that recovery overrides
    * our recovery. Simply return in this case. */
@@ -417,25 +437,43 @@ void FiveStageSimulator::PipeRecover(uint32_t dest_pc) {
   branch_next_pc_ = dest_pc;
 }
 
-void FiveStageSimulator::PrintStatistics() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::PrintStatistics() const {
   printf("------------ STATISTICS -----------\n");
-  printf("Number of Instructions: %u\n", history_.inst_count);
-  printf("Number of Cycles: %u\n", history_.cycle_count);
+  printf("Number of Instructions: %lu\n", history_.inst_count);
+  printf("Number of Cycles: %lu\n", history_.cycle_count);
   printf("Avg Cycles per Instrcution: %.4f\n",
          (float)history_.cycle_count / history_.inst_count);
   printf("Number of Control Hazards: %u\n", history_.control_hazard_count);
   printf("Number of Data Hazards: %u\n", history_.data_hazard_count);
+  printf("Resident Memory: %lu KB\n", memory_->ResidentSize() / 1024);
   printf("-----------------------------------\n");
 
   // Task 4
   memory_->PrintStatistics();
 }
 
-std::string FiveStageSimulator::GetRegInfoStr() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::RecordCycle() {
+  auto& reg_record = history_.reg_record;
+  if (reg_record.Size() == reg_record.Capacity()) {
+    // fold the record about to be overwritten into the base state
+    const auto& oldest = reg_record[0];
+    if (oldest.reg > 0) {
+      history_.reg_base[oldest.reg] = oldest.value;
+    }
+  }
+  reg_record.Push({pc_, history_.wb_value, history_.wb_reg});
+  history_.wb_reg = -1;
+}
+
+template <typename Policy>
+std::string FiveStageSimulator<Policy>::GetRegInfoStr(uint64_t pc,
+                                              const Regs& regs) const {
   std::string str = "------------ CPU STATE ------------\n";
-  str += std::format("PC: {:#x}\n", pc_);
+  str += std::format("PC: {:#x}\n", pc);
   for (uint32_t i = 0; i < 32; ++i) {
-    str += std::format("{}: {:#018x}({}) ", REGNAME[i], regs_[i], regs_[i]);
+    str += std::format("{}: {:#018x}({}) ", REGNAME[i], regs[i], regs[i]);
     if (i % 4 == 3) {
       str += "\n";
     }
@@ -444,17 +482,50 @@ std::string FiveStageSimulator::GetRegInfoStr() const {
   return str;
 }
 
-void FiveStageSimulator::DumpHistory() const {
+template <typename Policy>
+void FiveStageSimulator<Policy>::DumpHistory() const {
   std::ofstream ofile("dump.txt");
   ofile << "================== Excecution History =================="
         << std::endl;
-  for (uint32_t i = 0; i < history_.inst_record.size(); ++i) {
-    ofile << history_.inst_record[i];
-    ofile << history_.reg_record[i];
+
+  const auto& inst_record = history_.inst_record;
+  const auto& reg_record = history_.reg_record;
+  auto dump_inst = [&](uint64_t i) {
+    ofile << std::format("{:#010x}: {}\n", inst_record[i].pc,
+                         DisassembleInst(inst_record[i].inst));
+  };
+
+  // each instruction is dumped with the CPU state after the cycle it is
+  // decoded in, rebuilt by replaying register writes from reg_base
+  Regs regs = history_.reg_base;
+  uint64_t first_cycle = reg_record.Pushed() - reg_record.Size();
+  uint64_t i = 0;
+  while (i < inst_record.Size() && inst_record[i].cycle < first_cycle) {
+    ++i;
+  }
+  for (uint64_t c = 0; c < reg_record.Size(); ++c) {
+    const auto& record = reg_record[c];
+    if (record.reg > 0) {
+      regs[record.reg] = record.value;
+    }
+    for (; i < inst_record.Size() && inst_record[i].cycle == first_cycle + c;
+         ++i) {
+      dump_inst(i);
+      ofile << GetRegInfoStr(record.pc, regs);
+    }
+  }
+  // instructions of the unfinished cycle, e.g. when panicking
+  for (; i < inst_record.Size(); ++i) {
+    dump_inst(i);
+    ofile << GetRegInfoStr(pc_, regs_);
   }
   ofile << "========================================================"
         << std::endl;
   ofile << std::endl;
 
   ofile.close();
-}
\ No newline at end of file
+}
+
+// the only two instantiations, selected in Simulator::Create
+template class FiveStageSimulator<DebugTrace>;
+template class FiveStageSimulator<NoTrace>;
@@ -0,0 +1,351 @@
+#include "functional_engine.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jit.h"
+#include "memory_manager.h"
+#include "riscv.h"
+
+using namespace RISCV;
+
+FunctionalEngine::FunctionalEngine(MemoryManager* mem, uint64_t stack_limit,
+                                   bool jit, bool jit_check)
+    : mem_(mem),
+      stack_limit_(stack_limit),
+      code_pages_((1ULL << (32 - PAGE_SHIFT)) / 64, 0),
+      jit_check_(jit_check) {
+  if (jit || jit_check) {
+    jit_ = std::make_unique<Jit>();
+  }
+}
+
+FunctionalEngine::~FunctionalEngine() = default;
+
+// same semantics as ExecuteInst + MemoryAccessInst + write back,
+// including the 32-bit jump_pc the pipeline recovers to
+template <InstType T, FunctionalEngine::Form F>
+bool FunctionalEngine::Exec(FunctionalEngine& e, const ThreadedInst& inst) {
+  auto& x = e.x_;
+  const int64_t pc = inst.pc;
+  const int64_t offset = inst.offset;
+  int64_t op1 = 0, op2 = 0;
+  if constexpr (F == IMM) {
+    op1 = inst.imm;
+  } else if constexpr (F == REG_IMM) {
+    op1 = x[inst.rs1];
+    op2 = inst.imm;
+  } else {
+    op1 = x[inst.rs1];
+    op2 = x[inst.rs2];
+  }
+
+  auto branch = [&](bool taken) {
+    uint32_t jump_pc = pc + 4;
+    if (taken) {
+      jump_pc = pc + offset;
+    }
+    e.next_pc_ = jump_pc;
+    return false;
+  };
+
+  if constexpr (T == LUI) {
+    x[inst.rd] = offset << 12;
+  } else if constexpr (T == AUIPC) {
+    x[inst.rd] = pc + (offset << 12);
+  } else if constexpr (T == JAL) {
+    uint32_t jump_pc = pc + op1;
+    x[inst.rd] = pc + 4;
+    e.next_pc_ = jump_pc;
+    return false;
+  } else if constexpr (T == JALR) {
+    uint32_t jump_pc = (op1 + op2) & (~(uint64_t)1);
+    x[inst.rd] = pc + 4;
+    e.next_pc_ = jump_pc;
+    return false;
+  } else if constexpr (T == BEQ) {
+    return branch(op1 == op2);
+  } else if constexpr (T == BNE) {
+    return branch(op1 != op2);
+  } else if constexpr (T == BLT) {
+    return branch(op1 < op2);
+  } else if constexpr (T == BGE) {
+    return branch(op1 >= op2);
+  } else if constexpr (T == BLTU) {
+    return branch((uint64_t)op1 < (uint64_t)op2);
+  } else if constexpr (T == BGEU) {
+    return branch((uint64_t)op1 >= (uint64_t)op2);
+  } else if constexpr (T == LB || T == LH || T == LW || T == LD ||
+                       T == LBU || T == LHU || T == LWU) {
+    x[inst.rd] = e.Load<T>(op1 + offset);
+  } else if constexpr (T == SB || T == SH || T == SW || T == SD) {
+    if (!e.Store<T>(op1 + offset, op2)) {
+      e.next_pc_ = pc + 4;
+      return false;
+    }
+  } else if constexpr (T == ADDI || T == ADD) {
+    x[inst.rd] = op1 + op2;
+  } else if constexpr (T == ADDIW || T == ADDW) {
+    x[inst.rd] = (int64_t)((int32_t)op1 + (int32_t)op2);
+  } else if constexpr (T == SUB) {
+    x[inst.rd] = op1 - op2;
+  } else if constexpr (T == SUBW) {
+    x[inst.rd] = (int64_t)((int32_t)op1 - (int32_t)op2);
+  } else if constexpr (T == MUL) {
+    x[inst.rd] = op1 * op2;
+  } else if constexpr (T == DIV) {
+    x[inst.rd] = op1 / op2;
+  } else if constexpr (T == REM) {
+    x[inst.rd] = op1 % op2;
+  } else if constexpr (T == SLTI || T == SLT) {
+    x[inst.rd] = op1 < op2 ? 1 : 0;
+  } else if constexpr (T == SLTIU || T == SLTU) {
+    x[inst.rd] = (uint64_t)op1 < (uint64_t)op2 ? 1 : 0;
+  } else if constexpr (T == XORI || T == XOR) {
+    x[inst.rd] = op1 ^ op2;
+  } else if constexpr (T == ORI || T == OR) {
+    x[inst.rd] = op1 | op2;
+  } else if constexpr (T == ANDI || T == AND) {
+    x[inst.rd] = op1 & op2;
+  } else if constexpr (T == SLLI || T == SLL) {
+    x[inst.rd] = op1 << op2;
+  } else if constexpr (T == SLLIW || T == SLLW) {
+    x[inst.rd] = int64_t(int32_t(op1 << op2));
+  } else if constexpr (T == SRLI || T == SRL) {
+    x[inst.rd] = (uint64_t)op1 >> (uint64_t)op2;
+  } else if constexpr (T == SRLIW || T == SRLW) {
+    x[inst.rd] = uint64_t(uint32_t((uint32_t)op1 >> (uint32_t)op2));
+  } else if constexpr (T == SRAI || T == SRA) {
+    x[inst.rd] = op1 >> op2;
+  } else if constexpr (T == SRAW || T == SRAIW) {
+    x[inst.rd] = int64_t(int32_t((int32_t)op1 >> (int32_t)op2));
+  } else if constexpr (T == ECALL) {
+    bool exit_ctrl = false;
+    int64_t out = HandleSystemCall(&exit_ctrl, op2, op1, e.mem_);
+    if (exit_ctrl) {
+      e.exited_ = true;
+      e.next_pc_ = pc + 4;
+      return false;
+    }
+    x[inst.rd] = out;
+  } else {
+    throw std::runtime_error(std::format("Unknown instruction type: {}\n",
+                                         static_cast<int>(T)));
+  }
+  return true;
+}
+
+template <std::size_t... I>
+constexpr auto FunctionalEngine::MakeHandlers(std::index_sequence<I...>) {
+  return std::array<std::array<Handler, FORM_NUM>, sizeof...(I)>{
+      {{&Exec<InstType(I), IMM>, &Exec<InstType(I), REG_IMM>,
+        &Exec<InstType(I), REG_REG>}...}};
+}
+
+std::unique_ptr<FunctionalEngine::Block> FunctionalEngine::Translate(
+    uint64_t pc) {
+  static constexpr auto HANDLERS =
+      MakeHandlers(std::make_index_sequence<SRAW + 1>());
+
+  auto block = std::make_unique<Block>();
+  block->pc = pc;
+  block->bbv_id = bbv_ids_.emplace(pc, bbv_ids_.size()).first->second;
+  for (uint64_t inst_pc = pc; block->insts.size() < MAX_BLOCK_INSTS;
+       inst_pc += 4) {
+    DecodedInst decoded;
+    try {
+      decoded = PredecodeInst(mem_->GetInt(inst_pc));
+    } catch (const std::exception&) {
+      // a bad instruction is only reported once it is reached
+      if (block->insts.empty()) {
+        throw;
+      }
+      break;
+    }
+
+    Form form = decoded.rs1 < 0   ? IMM
+                : decoded.rs2 < 0 ? REG_IMM
+                                  : REG_REG;
+    ThreadedInst inst;
+    inst.handler = HANDLERS[decoded.inst_type][form];
+    inst.pc = inst_pc;
+    inst.imm = decoded.imm;
+    inst.offset = decoded.offset;
+    inst.rd = decoded.dest_reg > 0 ? decoded.dest_reg : REGNUM;
+    inst.rs1 = std::max<int8_t>(decoded.rs1, 0);
+    inst.rs2 = std::max<int8_t>(decoded.rs2, 0);
+    inst.form = form;
+    inst.type = decoded.inst_type;
+    block->insts.push_back(inst);
+
+    for (uint64_t addr : {inst_pc, inst_pc + 3}) {
+      uint64_t page = (addr & 0xFFFFFFFF) >> PAGE_SHIFT;
+      code_pages_[page / 64] |= 1ULL << (page % 64);
+    }
+    if (IsBranch(decoded.inst_type) || IsJump(decoded.inst_type)) {
+      break;
+    }
+  }
+  return block;
+}
+
+FunctionalEngine::Block* FunctionalEngine::GetBlock(uint64_t pc) {
+  Block*& slot = lookup_[(pc >> 2) & (LOOKUP_NUM - 1)];
+  if (slot != nullptr && slot->pc == pc) {
+    return slot;
+  }
+  auto it = blocks_.find(pc);
+  if (it == blocks_.end()) {
+    it = blocks_.emplace(pc, Translate(pc)).first;
+  }
+  slot = it->second.get();
+  return slot;
+}
+
+void FunctionalEngine::Flush() {
+  blocks_.clear();
+  lookup_.fill(nullptr);
+  std::fill(code_pages_.begin(), code_pages_.end(), 0);
+  if (jit_) {
+    jit_->Reset();
+  }
+  flush_pending_ = false;
+}
+
+uint64_t FunctionalEngine::Interpret(const Block& block, uint64_t n,
+                                     uint64_t& pc) {
+  const ThreadedInst* insts = block.insts.data();
+  uint64_t i = 0;
+  while (i < n && insts[i].handler(*this, insts[i])) {
+    ++i;
+  }
+  if (i < n) {
+    // left early, the handler has set the next pc
+    ++i;
+    pc = next_pc_;
+  } else {
+    pc = block.pc + 4 * n;
+  }
+  return i;
+}
+
+uint64_t FunctionalEngine::RunJit(const Block& block, uint64_t& pc) {
+  JitResult result = block.jit_code(x_.data(), this);
+  if (jit_fault_) {
+    std::rethrow_exception(std::exchange(jit_fault_, nullptr));
+  }
+  pc = result.next_pc;
+  return result.count;
+}
+
+uint64_t FunctionalEngine::RunJitChecked(const Block& block, uint64_t& pc) {
+  auto regs = x_;
+  std::vector<StoreRecord> interp_stores, jit_stores;
+
+  // interpret first, then roll registers and memory back
+  store_log_ = &interp_stores;
+  uint64_t interp_pc = pc;
+  uint64_t interp_count = Interpret(block, block.insts.size(), interp_pc);
+  auto interp_regs = x_;
+  for (auto it = interp_stores.rbegin(); it != interp_stores.rend(); ++it) {
+    StoreBytes(it->addr, it->len, it->old_value);
+  }
+  x_ = regs;
+
+  store_log_ = &jit_stores;
+  uint64_t count = RunJit(block, pc);
+  store_log_ = nullptr;
+
+  auto same_store = [](const StoreRecord& a, const StoreRecord& b) {
+    return a.addr == b.addr && a.len == b.len && a.value == b.value;
+  };
+  std::string diff;
+  if (pc != interp_pc || count != interp_count) {
+    diff += std::format("  next pc {:#x} count {}, interpreter {:#x} {}\n",
+                        pc, count, interp_pc, interp_count);
+  }
+  for (int i = 0; i < REGNUM; ++i) {
+    if (x_[i] != interp_regs[i]) {
+      diff += std::format("  {} = {:#x}, interpreter {:#x}\n", REGNAME[i],
+                          x_[i], interp_regs[i]);
+    }
+  }
+  if (!std::equal(jit_stores.begin(), jit_stores.end(), interp_stores.begin(),
+                  interp_stores.end(), same_store)) {
+    diff += std::format("  {} stores differ from {} of the interpreter\n",
+                        jit_stores.size(), interp_stores.size());
+  }
+  if (!diff.empty()) {
+    throw std::runtime_error(std::format(
+        "JIT mismatch in block at {:#x}\n{}", block.pc, diff));
+  }
+  return count;
+}
+
+uint64_t FunctionalEngine::Run(uint64_t& pc, Regs& regs, uint64_t max_insts,
+                               uint64_t until_pc, bool* exited) {
+  std::copy(regs.begin(), regs.end(), x_.begin());
+  exited_ = false;
+
+  uint64_t count = 0;
+  try {
+    while (count < max_insts && pc != until_pc) {
+      if (x_[REG_SP] < stack_limit_) {
+        throw std::runtime_error("Stack Overflow!\n");
+      }
+      if (pc % 2 != 0) {
+        throw std::runtime_error(std::format("Illegal PC {:#x}!\n", pc));
+      }
+
+      Block* block = GetBlock(pc);
+      // cut the block short to stop exactly at the limits
+      uint64_t n = std::min<uint64_t>(block->insts.size(), max_insts - count);
+      if (until_pc > pc && until_pc < pc + 4 * n) {
+        n = (until_pc - pc + 3) / 4;
+      }
+
+      if (jit_ && n == block->insts.size() && !block->jit_tried &&
+          ++block->exec_count >= JIT_THRESHOLD) {
+        block->jit_tried = true;
+        block->jit_code = jit_->Compile(*block);
+        if (block->jit_code == nullptr && jit_->Full()) {
+          // start over with an empty code buffer
+          flush_pending_ = true;
+        }
+      }
+
+      uint64_t executed = 0;
+      if (block->jit_code != nullptr && n == block->insts.size()) {
+        executed =
+            jit_check_ ? RunJitChecked(*block, pc) : RunJit(*block, pc);
+      } else {
+        executed = Interpret(*block, n, pc);
+      }
+      count += executed;
+      if (bbv_ != nullptr) {
+        if (block->bbv_id >= bbv_->size()) {
+          bbv_->resize(block->bbv_id + 1);
+        }
+        (*bbv_)[block->bbv_id] += executed;
+      }
+
+      if (exited_) {
+        break;
+      }
+      if (flush_pending_) {
+        Flush();
+      }
+    }
+  } catch (...) {
+    std::copy_n(x_.begin(), REGNUM, regs.begin());
+    throw;
+  }
+
+  std::copy_n(x_.begin(), REGNUM, regs.begin());
+  *exited = exited_;
+  return count;
+}
@@ -0,0 +1,214 @@
+#ifndef SRC_FUNCTIONAL_ENGINE_H
+#define SRC_FUNCTIONAL_ENGINE_H
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "memory_manager.h"
+#include "riscv.h"
+
+class FunctionalEngine;
+class Jit;
+
+// host code of a translated block, returns in rax:rdx
+struct JitResult {
+  uint64_t next_pc;
+  uint64_t count;  // instructions completed
+};
+using JitCode = JitResult (*)(uint64_t* regs, FunctionalEngine* engine);
+
+// functional ISA engine without any timing, used for fast-forwarding.
+// straight-line code is translated once into basic blocks of handler
+// pointers (direct threading), so running an instruction is one call to
+// the handler of exactly its type instead of the ExecuteInst switch.
+// with a Jit attached, hot blocks are further translated to host code
+class FunctionalEngine {
+  friend class Jit;
+
+ public:
+  // how an instruction gets its operands, fixed by its opcode
+  enum Form { IMM, REG_IMM, REG_REG, FORM_NUM };
+
+  struct ThreadedInst;
+  // returns false to leave the block after this instruction
+  using Handler = bool (*)(FunctionalEngine& engine, const ThreadedInst& inst);
+
+  struct ThreadedInst {
+    Handler handler = nullptr;
+    uint64_t pc = 0;
+    int64_t imm = 0;
+    int64_t offset = 0;
+    uint8_t rd = 0;  // REGNUM if the result is discarded
+    uint8_t rs1 = 0;
+    uint8_t rs2 = 0;
+    uint8_t form = IMM;
+    RISCV::InstType type = RISCV::UNKNOWN;
+  };
+
+  struct Block {
+    uint64_t pc = 0;
+    std::vector<ThreadedInst> insts;
+
+    // index into the basic block vector, kept across flushes
+    uint32_t bbv_id = 0;
+
+    uint32_t exec_count = 0;
+    bool jit_tried = false;
+    JitCode jit_code = nullptr;
+  };
+
+ private:
+  static constexpr uint32_t MAX_BLOCK_INSTS = 64;
+  static constexpr uint32_t LOOKUP_NUM = 1 << 12;
+  static constexpr uint32_t PAGE_SHIFT = 12;
+  // executions before a block is handed to the Jit
+  static constexpr uint32_t JIT_THRESHOLD = 16;
+
+  MemoryManager* mem_;
+  uint64_t stack_limit_;
+
+  // register file during Run, x_[REGNUM] swallows writes to x0
+  std::array<uint64_t, RISCV::REGNUM + 1> x_{};
+  // set by the handler that leaves a block early
+  uint64_t next_pc_ = 0;
+  bool exited_ = false;
+  bool flush_pending_ = false;
+
+  // block cache indexed by start pc, with a direct-mapped front
+  std::unordered_map<uint64_t, std::unique_ptr<Block>> blocks_;
+  std::array<Block*, LOOKUP_NUM> lookup_{};
+  // one bit per guest page holding translated code
+  std::vector<uint64_t> code_pages_;
+
+  std::unique_ptr<Jit> jit_;
+  bool jit_check_ = false;
+  // exception raised inside host code, rethrown once it has returned
+  std::exception_ptr jit_fault_;
+
+  // stores of one block, kept to roll it back when cross-checking
+  struct StoreRecord {
+    uint64_t addr;
+    uint32_t len;
+    uint64_t old_value;
+    uint64_t value;
+  };
+  std::vector<StoreRecord>* store_log_ = nullptr;
+
+  // instructions executed per block id while profiling
+  std::vector<uint64_t>* bbv_ = nullptr;
+  std::unordered_map<uint64_t, uint32_t> bbv_ids_;
+
+  Block* GetBlock(uint64_t pc);
+  std::unique_ptr<Block> Translate(uint64_t pc);
+
+  // run the first `n` instructions of `block`, return the number completed
+  uint64_t Interpret(const Block& block, uint64_t n, uint64_t& pc);
+  uint64_t RunJit(const Block& block, uint64_t& pc);
+  uint64_t RunJitChecked(const Block& block, uint64_t& pc);
+
+  bool IsCodePage(uint64_t addr) const {
+    uint64_t page = (addr & 0xFFFFFFFF) >> PAGE_SHIFT;
+    return (code_pages_[page / 64] >> (page % 64)) & 1;
+  }
+
+  // memory access of load / store type T, shared with the Jit
+  template <RISCV::InstType T>
+  uint64_t Load(uint64_t addr);
+  // returns false if the store hit translated code, which drops every block
+  // once the current one is left
+  template <RISCV::InstType T>
+  bool Store(uint64_t addr, uint64_t value);
+  void StoreBytes(uint64_t addr, uint32_t len, uint64_t value) {
+    switch (len) {
+      case 1:
+        mem_->SetByte(addr, value);
+        break;
+      case 2:
+        mem_->SetShort(addr, value);
+        break;
+      case 4:
+        mem_->SetInt(addr, value);
+        break;
+      default:
+        mem_->SetLong(addr, value);
+        break;
+    }
+  }
+
+  template <RISCV::InstType T, Form F>
+  static bool Exec(FunctionalEngine& e, const ThreadedInst& inst);
+  // handler of every (InstType, Form) pair, indexed in that order
+  template <std::size_t... I>
+  static constexpr auto MakeHandlers(std::index_sequence<I...>);
+
+ public:
+  // `stack_limit` is the lowest legal stack pointer. with `jit`, hot blocks
+  // run as host code, `jit_check` also runs them on the interpreter first
+  // and panics on any difference
+  FunctionalEngine(MemoryManager* mem, uint64_t stack_limit, bool jit = false,
+                   bool jit_check = false);
+  ~FunctionalEngine();
+
+  // run from `pc` on `regs` for at most `max_insts` instructions or until
+  // `pc` reaches `until_pc`, both are updated in place. returns the number
+  // of instructions executed, `exited` tells an exit() system call stopped it
+  uint64_t Run(uint64_t& pc, RISCV::Regs& regs, uint64_t max_insts,
+               uint64_t until_pc, bool* exited);
+
+  // drop every translated block, needed once code may have been changed
+  // by someone else than the engine
+  void Flush();
+
+  // add the instructions executed in each block to `bbv`, indexed by an id
+  // given to every block start pc. nullptr stops profiling
+  void Profile(std::vector<uint64_t>* bbv) { bbv_ = bbv; }
+};
+
+template <RISCV::InstType T>
+uint64_t FunctionalEngine::Load(uint64_t addr) {
+  using namespace RISCV;
+  if constexpr (T == LB) {
+    return (int64_t)SEXT<8>(mem_->GetByte(addr));
+  } else if constexpr (T == LH) {
+    return (int64_t)SEXT<16>(mem_->GetShort(addr));
+  } else if constexpr (T == LW) {
+    return (int64_t)SEXT<32>(mem_->GetInt(addr));
+  } else if constexpr (T == LD) {
+    return mem_->GetLong(addr);
+  } else if constexpr (T == LBU) {
+    return mem_->GetByte(addr);
+  } else if constexpr (T == LHU) {
+    return mem_->GetShort(addr);
+  } else {
+    static_assert(T == LWU);
+    return mem_->GetInt(addr);
+  }
+}
+
+template <RISCV::InstType T>
+bool FunctionalEngine::Store(uint64_t addr, uint64_t value) {
+  using namespace RISCV;
+  constexpr uint32_t len = T == SB ? 1 : T == SH ? 2 : T == SW ? 4 : 8;
+  value &= BITMASK(len * 8);
+  if (store_log_ != nullptr) {
+    uint64_t old_value = len == 1   ? Load<LBU>(addr)
+                         : len == 2 ? Load<LHU>(addr)
+                         : len == 4 ? Load<LWU>(addr)
+                                    : Load<LD>(addr);
+    store_log_->push_back({addr, len, old_value, value});
+  }
+  StoreBytes(addr, len, value);
+
+  if (!IsCodePage(addr) && !IsCodePage(addr + len - 1)) {
+    return true;
+  }
+  flush_pending_ = true;
+  return false;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "jit.h"
+
+#include <sys/mman.h>
+
+#include <array>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "functional_engine.h"
+#include "riscv.h"
+
+using namespace RISCV;
+
+namespace {
+
+enum HostReg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RBX = 3 };
+
+// condition codes of jcc / setcc / cmovcc
+enum Cond : uint8_t { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+                      CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD };
+
+// just the handful of x86-64 instructions the translation needs,
+// operating on rax and rcx
+class Emitter {
+  std::vector<uint8_t> buf_;
+
+ public:
+  const std::vector<uint8_t>& Code() const { return buf_; }
+  std::size_t Size() const { return buf_.size(); }
+
+  void Bytes(std::initializer_list<uint8_t> bytes) {
+    buf_.insert(buf_.end(), bytes);
+  }
+  void Imm32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      buf_.push_back(value >> (i * 8));
+    }
+  }
+  void Imm64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      buf_.push_back(value >> (i * 8));
+    }
+  }
+
+  // push rbx, r12, rbp, leaving the stack 16-byte aligned for calls;
+  // rbx = regs, r12 = engine
+  void Prologue() {
+    Bytes({0x53, 0x41, 0x54, 0x55});
+    Bytes({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+  }
+  void Epilogue() { Bytes({0x5D, 0x41, 0x5C, 0x5B, 0xC3}); }
+
+  // mov dst, [rbx + reg * 8] / mov [rbx + reg * 8], src
+  void LoadReg(HostReg dst, uint8_t reg) {
+    Bytes({0x48, 0x8B, uint8_t(0x80 | dst << 3 | RBX)});
+    Imm32(reg * 8);
+  }
+  void StoreReg(uint8_t reg, HostReg src) {
+    Bytes({0x48, 0x89, uint8_t(0x80 | src << 3 | RBX)});
+    Imm32(reg * 8);
+  }
+  // mov r64, imm64 / mov r32, imm32 (zero-extending, flags untouched)
+  void MovImm(HostReg dst, uint64_t imm) {
+    Bytes({0x48, uint8_t(0xB8 + dst)});
+    Imm64(imm);
+  }
+  void MovImm32(HostReg dst, uint32_t imm) {
+    Bytes({uint8_t(0xB8 + dst)});
+    Imm32(imm);
+  }
+
+  // <op> rax, rcx (or eax, ecx) for add 01, sub 29, and 21, or 09,
+  // xor 31, cmp 39
+  void Alu(uint8_t opcode, bool wide = true) {
+    if (wide) {
+      Bytes({0x48});
+    }
+    Bytes({opcode, 0xC8});
+  }
+  void Imul() { Bytes({0x48, 0x0F, 0xAF, 0xC1}); }
+  // shl 4, shr 5, sar 7 of rax (or eax) by cl
+  void Shift(uint8_t ext, bool wide = true) {
+    if (wide) {
+      Bytes({0x48});
+    }
+    Bytes({0xD3, uint8_t(0xC0 | ext << 3)});
+  }
+  // movsxd rax, eax
+  void SignExtend32() { Bytes({0x48, 0x63, 0xC0}); }
+  // mov eax, eax
+  void ZeroExtend32() { Bytes({0x89, 0xC0}); }
+  // setcc al; movzx eax, al
+  void SetCond(Cond cc) {
+    Bytes({0x0F, uint8_t(0x90 + cc), 0xC0, 0x0F, 0xB6, 0xC0});
+  }
+  // cmovcc eax, ecx
+  void CmovCond(Cond cc) { Bytes({0x0F, uint8_t(0x40 + cc), 0xC1}); }
+  void AddImm32(int32_t imm) {
+    Bytes({0x48, 0x05});
+    Imm32(imm);
+  }
+  void AndImm8(int8_t imm) { Bytes({0x48, 0x83, 0xE0, uint8_t(imm)}); }
+
+  // helper(engine, addr = rax, value = rcx)
+  void CallHelper(const void* fn) {
+    Bytes({0x4C, 0x89, 0xE7});  // mov rdi, r12
+    Bytes({0x48, 0x89, 0xC6});  // mov rsi, rax
+    Bytes({0x48, 0x89, 0xCA});  // mov rdx, rcx
+    Bytes({0x49, 0xBB});        // mov r11, fn
+    Imm64(reinterpret_cast<uint64_t>(fn));
+    Bytes({0x41, 0xFF, 0xD3});  // call r11
+  }
+  void TestRdx() { Bytes({0x48, 0x85, 0xD2}); }
+  void CmpEax(int8_t imm) { Bytes({0x83, 0xF8, uint8_t(imm)}); }
+
+  // jcc rel32 with the target bound later, returns where rel32 is
+  std::size_t Jcc(Cond cc) {
+    Bytes({0x0F, uint8_t(0x80 + cc)});
+    Imm32(0);
+    return buf_.size() - 4;
+  }
+  void Bind(std::size_t rel_at) {
+    uint32_t rel = buf_.size() - (rel_at + 4);
+    std::memcpy(&buf_[rel_at], &rel, 4);
+  }
+};
+
+// leave with the next pc in rax and the completed count in rdx
+void EmitExit(Emitter& as, uint64_t next_pc, uint64_t count) {
+  as.MovImm(RAX, next_pc);
+  as.MovImm32(RDX, count);
+  as.Epilogue();
+}
+
+}  // namespace
+
+template <InstType T>
+Jit::LoadResult Jit::Load(FunctionalEngine* engine, uint64_t addr) noexcept {
+  try {
+    return {engine->Load<T>(addr), 0};
+  } catch (...) {
+    engine->jit_fault_ = std::current_exception();
+    return {0, 1};
+  }
+}
+
+template <InstType T>
+uint64_t Jit::Store(FunctionalEngine* engine, uint64_t addr,
+                    uint64_t value) noexcept {
+  try {
+    return engine->Store<T>(addr, value) ? 0 : 1;
+  } catch (...) {
+    engine->jit_fault_ = std::current_exception();
+    return 2;
+  }
+}
+
+bool Jit::Supported() {
+#if defined(__x86_64__) && defined(__linux__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+Jit::Jit() {
+  if (!Supported()) {
+    return;
+  }
+  void* code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED) {
+    code_ = static_cast<uint8_t*>(code);
+  }
+}
+
+Jit::~Jit() {
+  if (code_ != nullptr) {
+    munmap(code_, CODE_SIZE);
+  }
+}
+
+void Jit::Reset() {
+  used_ = 0;
+  full_ = false;
+}
+
+JitCode Jit::Compile(const FunctionalEngine::Block& block) {
+  if (code_ == nullptr) {
+    return nullptr;
+  }
+  for (const auto& inst : block.insts) {
+    if (inst.type == DIV || inst.type == REM || inst.type == ECALL) {
+      return nullptr;
+    }
+  }
+
+  struct Exit {
+    std::size_t rel_at;
+    uint64_t next_pc;
+    uint64_t count;
+  };
+  std::vector<Exit> exits;
+  Emitter as;
+  as.Prologue();
+
+  bool ended = false;
+  for (uint64_t i = 0; i < block.insts.size(); ++i) {
+    const auto& inst = block.insts[i];
+    const uint64_t pc = inst.pc;
+    const int64_t offset = inst.offset;
+
+    if (inst.form != FunctionalEngine::IMM) {
+      as.LoadReg(RAX, inst.rs1);
+      if (inst.form == FunctionalEngine::REG_IMM) {
+        as.MovImm(RCX, inst.imm);
+      } else {
+        as.LoadReg(RCX, inst.rs2);
+      }
+    }
+
+    switch (inst.type) {
+      case LUI:
+        as.MovImm(RAX, offset << 12);
+        break;
+      case AUIPC:
+        as.MovImm(RAX, pc + (offset << 12));
+        break;
+      case JAL:
+        as.MovImm(RAX, pc + 4);
+        as.StoreReg(inst.rd, RAX);
+        EmitExit(as, uint32_t(pc + inst.imm), i + 1);
+        ended = true;
+        continue;
+      case JALR:
+        as.Alu(0x01);
+        as.AndImm8(-2);
+        as.ZeroExtend32();
+        as.MovImm(RCX, pc + 4);
+        as.StoreReg(inst.rd, RCX);
+        as.MovImm32(RDX, i + 1);
+        as.Epilogue();
+        ended = true;
+        continue;
+      case BEQ:
+      case BNE:
+      case BLT:
+      case BGE:
+      case BLTU:
+      case BGEU: {
+        static constexpr Cond CONDS[] = {CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE};
+        as.Alu(0x39);
+        as.MovImm32(RAX, uint32_t(pc + 4));
+        as.MovImm32(RCX, uint32_t(pc + offset));
+        as.CmovCond(CONDS[inst.type - BEQ]);
+        as.MovImm32(RDX, i + 1);
+        as.Epilogue();
+        ended = true;
+        continue;
+      }
+      case LB:
+      case LH:
+      case LW:
+      case LD:
+      case LBU:
+      case LHU:
+      case LWU: {
+        static const std::array<const void*, 7> LOADS = {
+            reinterpret_cast<const void*>(&Load<LB>),
+            reinterpret_cast<const void*>(&Load<LH>),
+            reinterpret_cast<const void*>(&Load<LW>),
+            reinterpret_cast<const void*>(&Load<LD>),
+            reinterpret_cast<const void*>(&Load<LBU>),
+            reinterpret_cast<const void*>(&Load<LHU>),
+            reinterpret_cast<const void*>(&Load<LWU>)};
+        as.AddImm32(offset);
+        as.CallHelper(inst.type == LWU ? LOADS[6] : LOADS[inst.type - LB]);
+        as.TestRdx();
+        exits.push_back({as.Jcc(CC_NE), pc, i});
+        break;
+      }
+      case SB:
+      case SH:
+      case SW:
+      case SD: {
+        static const std::array<const void*, 4> STORES = {
+            reinterpret_cast<const void*>(&Store<SB>),
+            reinterpret_cast<const void*>(&Store<SH>),
+            reinterpret_cast<const void*>(&Store<SW>),
+            reinterpret_cast<const void*>(&Store<SD>)};
+        as.AddImm32(offset);
+        as.CallHelper(STORES[inst.type - SB]);
+        as.CmpEax(1);
+        exits.push_back({as.Jcc(CC_E), pc + 4, i + 1});
+        exits.push_back({as.Jcc(CC_A), pc, i});
+        continue;
+      }
+      case ADDI:
+      case ADD:
+        as.Alu(0x01);
+        break;
+      case ADDIW:
+      case ADDW:
+        as.Alu(0x01, false);
+        as.SignExtend32();
+        break;
+      case SUB:
+        as.Alu(0x29);
+        break;
+      case SUBW:
+        as.Alu(0x29, false);
+        as.SignExtend32();
+        break;
+      case MUL:
+        as.Imul();
+        break;
+      case SLTI:
+      case SLT:
+        as.Alu(0x39);
+        as.SetCond(CC_L);
+        break;
+      case SLTIU:
+      case SLTU:
+        as.Alu(0x39);
+        as.SetCond(CC_B);
+        break;
+      case XORI:
+      case XOR:
+        as.Alu(0x31);
+        break;
+      case ORI:
+      case OR:
+        as.Alu(0x09);
+        break;
+      case ANDI:
+      case AND:
+        as.Alu(0x21);
+        break;
+      case SLLI:
+      case SLL:
+        as.Shift(4);
+        break;
+      case SLLIW:
+      case SLLW:
+        // shifted as 64 bits, then truncated
+        as.Shift(4);
+        as.SignExtend32();
+        break;
+      case SRLI:
+      case SRL:
+        as.Shift(5);
+        break;
+      case SRLIW:
+      case SRLW:
+        // zero-extended like the interpreter
+        as.Shift(5, false);
+        break;
+      case SRAI:
+      case SRA:
+        as.Shift(7);
+        break;
+      case SRAIW:
+      case SRAW:
+        as.Shift(7, false);
+        as.SignExtend32();
+        break;
+      default:
+        return nullptr;
+    }
+    as.StoreReg(inst.rd, RAX);
+  }
+  if (!ended) {
+    uint64_t n = block.insts.size();
+    EmitExit(as, block.pc + 4 * n, n);
+  }
+  for (const auto& stub : exits) {
+    as.Bind(stub.rel_at);
+    EmitExit(as, stub.next_pc, stub.count);
+  }
+
+  const auto& code = as.Code();
+  if (used_ + code.size() > CODE_SIZE) {
+    full_ = true;
+    return nullptr;
+  }
+  uint8_t* entry = code_ + used_;
+  std::memcpy(entry, code.data(), code.size());
+  used_ = (used_ + code.size() + 15) & ~std::size_t(15);
+  return reinterpret_cast<JitCode>(entry);
+}
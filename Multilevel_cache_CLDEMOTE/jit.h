@@ -0,0 +1,51 @@
+#ifndef SRC_JIT_H
+#define SRC_JIT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "functional_engine.h"
+#include "riscv.h"
+
+// translator of hot FunctionalEngine blocks into x86-64 host code, with its
+// own emitter and no dependencies. the generated code keeps the guest
+// registers in memory (rbx points to them, r12 to the engine) and calls
+// back into the engine for every load and store. blocks with DIV, REM or
+// ECALL are left to the interpreter
+class Jit {
+  static constexpr std::size_t CODE_SIZE = 16 << 20;
+
+  uint8_t* code_ = nullptr;
+  std::size_t used_ = 0;
+  bool full_ = false;
+
+  // entry points for the generated code, an exception is parked in the
+  // engine since it cannot unwind through host code
+  struct LoadResult {
+    uint64_t value;
+    uint64_t fault;
+  };
+  template <RISCV::InstType T>
+  static LoadResult Load(FunctionalEngine* engine, uint64_t addr) noexcept;
+  // 0 to go on, 1 to leave after a store into translated code, 2 on fault
+  template <RISCV::InstType T>
+  static uint64_t Store(FunctionalEngine* engine, uint64_t addr,
+                        uint64_t value) noexcept;
+
+ public:
+  Jit();
+  ~Jit();
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  // whether host code can run here at all
+  static bool Supported();
+
+  // nullptr if the block is not translatable or the code buffer is full
+  JitCode Compile(const FunctionalEngine::Block& block);
+  bool Full() const { return full_; }
+  // drop every translation, their blocks must be gone already
+  void Reset();
+};
+
+#endif
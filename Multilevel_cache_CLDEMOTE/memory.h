@@ -2,20 +2,55 @@
 #define SRC_MEMORY_H
 
 #include <elfio/elfio.hpp>
+#include <memory>
 #include <span>
 #include <vector>
 
 #include "byte_addressable.h"
 
+// sparse memory, pages are allocated on first write and untouched pages
+// read as zero
 class Memory final : public ByteAddressable {
-  std::vector<uint8_t> arena_;
+ public:
+  static constexpr uint32_t PAGE_SHIFT = 12;
+  static constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+
+ private:
+  std::vector<std::unique_ptr<uint8_t[]>> pages_;
+  // read-only pages of a shared image, copied into `pages_` on the first
+  // write. empty unless an image is mapped
+  std::vector<const uint8_t*> shared_;
+  std::size_t size_;
+  uint64_t resident_pages_ = 0;
 
   void CheckAddr(uint32_t addr, std::size_t len) const;
   void ReadSpan(uint32_t addr, std::span<uint8_t> out) override;
   void WriteSpan(uint32_t addr, std::span<const uint8_t> in) override;
 
  public:
-  explicit Memory(std::size_t size) : arena_(size, 0) {}
+  explicit Memory(std::size_t size)
+      : pages_((size + PAGE_SIZE - 1) >> PAGE_SHIFT), size_(size) {}
+
+  std::size_t Size() const { return size_; }
+  // bytes of the pages allocated so far
+  uint64_t ResidentSize() const { return resident_pages_ << PAGE_SHIFT; }
+
+  // clear [addr, addr + len), pages wholly inside are released
+  void Zero(uint32_t addr, std::size_t len);
+
+  // raw page access for checkpointing, bypassing any cache in front.
+  // FindPage returns nullptr for a page never written, GetPage always a
+  // private copy
+  const uint8_t* FindPage(uint64_t page) const {
+    if (pages_[page] || shared_.empty()) {
+      return pages_[page].get();
+    }
+    return shared_[page];
+  }
+  uint8_t* GetPage(uint64_t page);
+  // back `page` by `bytes` of an image mapped elsewhere until it is written.
+  // the mapping has to outlive this memory
+  void SharePage(uint64_t page, const uint8_t* bytes);
 };
 
 #endif
@@ -1,64 +1,84 @@
 #include "memory_manager.h"
 
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
 #include "cache.h"
+#include "checkpoint.h"
 #include "memory.h"
 
 MemoryManager::MemoryManager(const Options& opts) : opts_(opts) {
   // Task 1
   auto mem = std::make_unique<Memory>(opts.memory_size);
+  memory_ = mem.get();
 
   if (opts.enable_cache) {
     auto cache = std::make_unique<TieredCache>(opts, std::move(mem));
     cache_backend_ = cache.get();
+    timing_cache_ = opts.cache_model == CacheModel::Timing;
     backend_ = std::move(cache);
   } else {
     backend_ = std::move(mem);
   }
+
+  if (!opts.mem_trace_file.empty()) {
+    trace_file_ = std::make_unique<AccessTrace>(opts.mem_trace_file);
+    trace_ = trace_file_.get();
+  }
 }
 
 void MemoryManager::CopyFrom(const void* src, uint32_t dest, uint32_t len) {
   std::span<const uint8_t> data(reinterpret_cast<const uint8_t*>(src), len);
-  backend_->WriteSpan(dest, data);
+  static_cast<ByteAddressable*>(memory_)->WriteSpan(dest, data);
+  TlbInvalidate(dest, len);
 }
 
-void MemoryManager::SetByte(uint32_t addr, uint8_t val) {
-  backend_->Write(addr, val);
+void MemoryManager::Zero(uint32_t dest, uint32_t len) {
+  // pages may be released
+  TlbFlush();
+  memory_->Zero(dest, len);
 }
 
-void MemoryManager::SetShort(uint32_t addr, uint16_t val) {
-  backend_->Write(addr, val);
-}
-
-void MemoryManager::SetInt(uint32_t addr, uint32_t val) {
-  backend_->Write(addr, val);
-}
-
-void MemoryManager::SetLong(uint32_t addr, uint64_t val) {
-  backend_->Write(addr, val);
-}
-
-uint8_t MemoryManager::GetByte(uint32_t addr) const {
-  uint8_t value{};
-  backend_->Read(addr, value);
-  return value;
+uint8_t* MemoryManager::TlbFill(uint64_t page, bool write) const {
+  // pages reaching the end of memory are left to its range check
+  if ((page + 1) << Memory::PAGE_SHIFT >= memory_->Size()) {
+    return nullptr;
+  }
+  uint8_t* host = write ? memory_->GetPage(page)
+                        : const_cast<uint8_t*>(memory_->FindPage(page));
+  if (host != nullptr) {
+    tlb_[page % TLB_NUM] = {page, host, write};
+  }
+  return host;
 }
 
-uint16_t MemoryManager::GetShort(uint32_t addr) const {
-  uint16_t value{};
-  backend_->Read(addr, value);
-  return value;
+void MemoryManager::Flush() {
+  if (trace_file_) {
+    trace_file_->Flush();
+  }
+  if (cache_backend_) {
+    cache_backend_->Flush();
+  }
 }
 
-uint32_t MemoryManager::GetInt(uint32_t addr) const {
-  uint32_t value{};
-  backend_->Read(addr, value);
-  return value;
-}
+void MemoryManager::TlbFlush() { tlb_.fill(TlbEntry{}); }
 
-uint64_t MemoryManager::GetLong(uint32_t addr) const {
-  uint64_t value{};
-  backend_->Read(addr, value);
-  return value;
+void MemoryManager::TlbInvalidate(uint32_t addr, uint32_t len) {
+  if (len == 0) {
+    return;
+  }
+  uint64_t first = addr >> Memory::PAGE_SHIFT;
+  uint64_t last = ((uint64_t)addr + len - 1) >> Memory::PAGE_SHIFT;
+  for (uint64_t page = first; page <= last; ++page) {
+    TlbEntry& entry = tlb_[page % TLB_NUM];
+    if (entry.page == page) {
+      entry = TlbEntry{};
+    }
+  }
 }
 
 uint32_t MemoryManager::GetLastAccessLatency() const {
@@ -73,6 +93,9 @@ uint32_t MemoryManager::GetLastAccessLatency() const {
 }
 
 void MemoryManager::Demote(uint32_t addr) {
+  if (trace_ != nullptr) {
+    trace_->Record(AccessTrace::DEMOTE, access_pc_, addr, 1);
+  }
   // Task 2
   if (cache_backend_) {
     cache_backend_->Demote(addr);
@@ -84,4 +107,92 @@ void MemoryManager::PrintStatistics() const {
   if (cache_backend_) {
     cache_backend_->PrintStatistics();
   }
-}
\ No newline at end of file
+}
+
+uint64_t MemoryManager::ResidentSize() const { return memory_->ResidentSize(); }
+
+std::vector<CacheStats> MemoryManager::GetStatistics() const {
+  if (cache_backend_) {
+    return cache_backend_->GetStatistics();
+  }
+  return {};
+}
+
+void MemoryManager::SaveState(std::ostream& out, bool with_cache) {
+  using namespace Checkpoint;
+  if (cache_backend_) {
+    cache_backend_->SyncMemory();
+  }
+
+  // pages never written are zero and skipped without a look
+  const uint64_t size = memory_->Size();
+  constexpr uint32_t PAGE_SIZE = Memory::PAGE_SIZE;
+  std::vector<uint32_t> pages;
+  for (uint64_t page = 0; page * PAGE_SIZE < size; page++) {
+    const uint8_t* bytes = memory_->FindPage(page);
+    if (bytes != nullptr &&
+        std::any_of(bytes, bytes + PAGE_SIZE,
+                    [](uint8_t byte) { return byte != 0; })) {
+      pages.push_back(page);
+    }
+  }
+  Put<uint64_t>(out, size);
+  Put<uint32_t>(out, pages.size());
+  out.write(reinterpret_cast<const char*>(pages.data()),
+            pages.size() * sizeof(uint32_t));
+  for (uint32_t page : pages) {
+    uint64_t addr = (uint64_t)page * PAGE_SIZE;
+    out.write(reinterpret_cast<const char*>(memory_->FindPage(page)),
+              std::min<uint64_t>(PAGE_SIZE, size - addr));
+  }
+
+  // sized, so that a run without the same cache can skip it
+  std::ostringstream cache_state;
+  if (with_cache && cache_backend_) {
+    cache_backend_->SaveState(cache_state);
+  }
+  std::string cache_bytes = std::move(cache_state).str();
+  Put<uint64_t>(out, cache_bytes.size());
+  out.write(cache_bytes.data(), cache_bytes.size());
+}
+
+void MemoryManager::RestoreState(std::span<const uint8_t>& in, bool share) {
+  using namespace Checkpoint;
+  // private pages may be replaced by shared ones
+  TlbFlush();
+  constexpr uint32_t PAGE_SIZE = Memory::PAGE_SIZE;
+  uint64_t size = Get<uint64_t>(in);
+  if (size > memory_->Size()) {
+    throw std::runtime_error(
+        std::format("Checkpoint needs {} bytes of memory, only {} available\n",
+                    size, memory_->Size()));
+  }
+
+  uint32_t page_num = Get<uint32_t>(in);
+  auto pages = Take(in, (uint64_t)page_num * sizeof(uint32_t));
+  for (uint32_t i = 0; i < page_num; i++) {
+    uint32_t page;
+    std::memcpy(&page, pages.data() + i * sizeof(uint32_t), sizeof(page));
+    uint64_t addr = (uint64_t)page * PAGE_SIZE;
+    if (addr >= size) {
+      throw std::runtime_error(
+          std::format("Checkpoint page {:#x} out of memory\n", addr));
+    }
+    uint64_t len = std::min<uint64_t>(PAGE_SIZE, size - addr);
+    const uint8_t* bytes = Take(in, len).data();
+    if (share && len == PAGE_SIZE) {
+      memory_->SharePage(page, bytes);
+    } else {
+      std::memcpy(memory_->GetPage(page), bytes, len);
+    }
+  }
+
+  auto cache_state = Take(in, Get<uint64_t>(in));
+  if (cache_state.empty()) {
+    return;
+  }
+  if (!cache_backend_ || !cache_backend_->RestoreState(cache_state)) {
+    std::cerr << "Cache state in checkpoint does not match the cache "
+                 "configuration, starting cold\n";
+  }
+}
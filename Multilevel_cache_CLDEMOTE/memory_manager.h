@@ -1,9 +1,16 @@
 #ifndef SRC_MEMORY_MANAGER_H
 #define SRC_MEMORY_MANAGER_H
 
+#include <array>
+#include <cstring>
 #include <memory>
+#include <ostream>
+#include <span>
+#include <vector>
 
+#include "access_trace.h"
 #include "byte_addressable.h"
+#include "memory.h"
 #include "options.h"
 #include "cache.h"
 
@@ -11,24 +18,132 @@
 class MemoryManager {
   std::unique_ptr<ByteAddressable> backend_;
   Options opts_;
+  // main memory behind `backend_`, owned by it
+  Memory* memory_ = nullptr;
   
   // Task 1
   TieredCache* cache_backend_ = nullptr;
+  // the timing cache model leaves the data to memory, so the TLB keeps
+  // serving accesses and the cache is only told about them. writes missing
+  // the TLB reach memory through the cache and invalidate like any other
+  bool timing_cache_ = false;
+
+  // access trace, `trace_` is null while not recording
+  std::unique_ptr<AccessTrace> trace_file_;
+  AccessTrace* trace_ = nullptr;
+  // pc of the instruction making the data accesses
+  uint64_t access_pc_ = 0;
+
+  // software TLB, host pointers to recently used guest pages. used without
+  // a cache or with the timing cache model, accesses that miss it or cross
+  // a page take `backend_`
+  static constexpr uint32_t TLB_NUM = 256;
+  struct TlbEntry {
+    uint64_t page = UINT64_MAX;
+    uint8_t* host = nullptr;
+    // false for entries filled by a read, which may be a shared page
+    bool writable = false;
+  };
+  mutable std::array<TlbEntry, TLB_NUM> tlb_{};
+
+  // reads never allocate, so pages not yet written stay out of the TLB
+  uint8_t* Translate(uint32_t addr, uint32_t len, bool write) const {
+    if (cache_backend_ != nullptr && !timing_cache_) {
+      return nullptr;  // the cache model has to see every access
+    }
+    uint32_t offset = addr & (Memory::PAGE_SIZE - 1);
+    if (offset + len > Memory::PAGE_SIZE) {
+      return nullptr;
+    }
+    uint64_t page = addr >> Memory::PAGE_SHIFT;
+    const TlbEntry& entry = tlb_[page % TLB_NUM];
+    if (entry.page == page && (entry.writable || !write)) {
+      return entry.host + offset;
+    }
+    uint8_t* host = TlbFill(page, write);
+    return host != nullptr ? host + offset : nullptr;
+  }
+  uint8_t* TlbFill(uint64_t page, bool write) const;
+  void TlbFlush();
+  // drop the entries of the pages [addr, addr + len) touches. a write past
+  // the TLB may have copied a shared page that a read entry still points to
+  void TlbInvalidate(uint32_t addr, uint32_t len);
+
+  // accesses without recording them
+  template <typename T>
+  T Read(uint32_t addr) const {
+    T value{};
+    if (const uint8_t* host = Translate(addr, sizeof(T), false)) {
+      std::memcpy(&value, host, sizeof(T));
+      if (timing_cache_) {
+        cache_backend_->Access(addr, sizeof(T), false);
+      }
+    } else {
+      backend_->Read(addr, value);
+    }
+    return value;
+  }
+
+  template <typename T>
+  void Write(uint32_t addr, T value) {
+    if (uint8_t* host = Translate(addr, sizeof(T), true)) {
+      std::memcpy(host, &value, sizeof(T));
+      if (timing_cache_) {
+        cache_backend_->Access(addr, sizeof(T), true);
+      }
+    } else {
+      backend_->Write(addr, value);
+      TlbInvalidate(addr, sizeof(T));
+    }
+  }
+
+  template <typename T>
+  T Load(uint32_t addr) const {
+    if (trace_ != nullptr) [[unlikely]] {
+      trace_->Record(AccessTrace::LOAD, access_pc_, addr, sizeof(T));
+    }
+    return Read<T>(addr);
+  }
+
+  template <typename T>
+  void Store(uint32_t addr, T value) {
+    if (trace_ != nullptr) [[unlikely]] {
+      trace_->Record(AccessTrace::STORE, access_pc_, addr, sizeof(T));
+    }
+    Write(addr, value);
+  }
 
  public:
   explicit MemoryManager(const Options& opts);
 
+  // bulk load of an image straight into memory, not seen by any cache
   void CopyFrom(const void* src, uint32_t dest, uint32_t len);
+  // bulk clear, likewise bypassing any cache
+  void Zero(uint32_t dest, uint32_t len);
 
-  void SetByte(uint32_t addr, uint8_t val);
-  void SetShort(uint32_t addr, uint16_t val);
-  void SetInt(uint32_t addr, uint32_t val);
-  void SetLong(uint32_t addr, uint64_t val);
+  void SetByte(uint32_t addr, uint8_t val) { Store(addr, val); }
+  void SetShort(uint32_t addr, uint16_t val) { Store(addr, val); }
+  void SetInt(uint32_t addr, uint32_t val) { Store(addr, val); }
+  void SetLong(uint32_t addr, uint64_t val) { Store(addr, val); }
 
-  uint8_t GetByte(uint32_t addr) const;
-  uint16_t GetShort(uint32_t addr) const;
-  uint32_t GetInt(uint32_t addr) const;
-  uint64_t GetLong(uint32_t addr) const;
+  uint8_t GetByte(uint32_t addr) const { return Load<uint8_t>(addr); }
+  uint16_t GetShort(uint32_t addr) const { return Load<uint16_t>(addr); }
+  uint32_t GetInt(uint32_t addr) const { return Load<uint32_t>(addr); }
+  uint64_t GetLong(uint32_t addr) const { return Load<uint64_t>(addr); }
+
+  // instruction fetch, told apart from loads in the access trace
+  uint32_t FetchInst(uint64_t pc) const {
+    if (trace_ != nullptr) [[unlikely]] {
+      trace_->Record(AccessTrace::FETCH, pc, pc, 4);
+    }
+    return Read<uint32_t>(pc);
+  }
+  // pc recorded with the following loads and stores
+  void SetAccessPc(uint64_t pc) { access_pc_ = pc; }
+  // pause or resume recording, if there is a trace at all
+  void Trace(bool on) { trace_ = on ? trace_file_.get() : nullptr; }
+  // write out buffered access and cache trace records, needed before exit()
+  void Flush();
 
   // Task 3
   uint32_t GetLastAccessLatency() const;
@@ -38,6 +153,19 @@ class MemoryManager {
 
   // Task 4 
   void PrintStatistics() const;
+  // empty without a cache
+  std::vector<CacheStats> GetStatistics() const;
+  // bytes of guest memory actually allocated
+  uint64_t ResidentSize() const;
+
+  // checkpointing, neither counts as an access. memory is saved as the
+  // program sees it, `with_cache` adds the cache contents, which are only
+  // restored into a cache of the same geometry
+  void SaveState(std::ostream& out, bool with_cache);
+  // `in` is advanced past the saved state. with `share`, whole pages are
+  // not copied but mapped copy-on-write from `in`, which then has to
+  // outlive this manager
+  void RestoreState(std::span<const uint8_t>& in, bool share = false);
 };
 
 #endif
\ No newline at end of file
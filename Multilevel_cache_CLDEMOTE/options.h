@@ -3,8 +3,11 @@
 
 #include <CLI11/CLI11.hpp>
 #include <cstdint>
+#include <format>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -12,7 +15,10 @@ inline static std::vector<std::string> pipeline_modes{"five-stage"};
 
 enum class WritePolicy { WBWA };
 enum class InclusionPolicy { Inclusive, Exclusive };
-enum class ReplacementPolicy { LRU, Random };
+// plru is tree pseudo-LRU, bitplru pseudo-LRU by MRU bits
+enum class ReplacementPolicy { LRU, Random, PLRU, BitPLRU };
+// the timing model keeps no line data, accesses go straight to memory
+enum class CacheModel { Functional, Timing };
 
 // configuration for a single cache level
 struct CacheLevelConfig {
@@ -29,12 +35,14 @@ struct Options {
   bool verbose = false;
   bool single_step = false;
   bool dump_history = false;
-  uint32_t memory_size = 100 * 1024 * 1024;
+  // allocated lazily, up to the whole 32-bit address space
+  uint64_t memory_size = 100 * 1024 * 1024;
 
   // cache configuration (global shared policies)
   bool enable_cache = false;
   WritePolicy write_policy = WritePolicy::WBWA;
   InclusionPolicy inclusion_policy = InclusionPolicy::Inclusive;
+  CacheModel cache_model = CacheModel::Functional;
   std::vector<CacheLevelConfig> cache_levels;
 
   // latency simulation
@@ -44,27 +52,54 @@ struct Options {
   // trace options
   bool enable_trace = false;
   std::string trace_output_file;
+  // binary trace of every access, see access_trace.h
+  std::string mem_trace_file;
 
-  static Options Parse(int argc, char** argv) {
-    Options opts;
+  // functional fast-forward before the detailed simulation,
+  // 0 disables the limit
+  uint64_t fast_forward = 0;
+  uint64_t fast_forward_until = 0;
+  // translate hot fast-forward blocks to host code
+  bool jit = false;
+  bool jit_check = false;
 
-    CLI::App app{"RISC-V Simulator"};
-    app.allow_extras(false);
+  // architectural state saved after fast-forwarding, or loaded instead of
+  // the ELF file
+  std::string checkpoint_out;
+  std::string checkpoint_in;
+  bool checkpoint_cache = false;
+  std::string shared_image;
 
-    app.add_option("-i,--input", opts.input_file, "RISC-V ELF binary file")
-        ->required()
-        ->check(CLI::ExistingFile);
-    app.add_flag("-v,--verbose", opts.verbose, "Enable verbose output");
-    app.add_flag("-s,--single_step", opts.single_step,
-                 "Enable single-step execution");
-    app.add_flag("-d,--dump_history", opts.dump_history,
-                 "Dump execution history to dump.txt");
-    app.add_option("--memory_size", opts.memory_size, "Memory size in bytes")
-        ->default_val(opts.memory_size);
-    app.add_option("--pipeline_mode", opts.pipeline_mode, "Pipeline mode")
-        ->default_val(opts.pipeline_mode)
-        ->check(CLI::IsMember(pipeline_modes));
+  // SimPoint profiling of basic block vectors per interval, and sampled
+  // simulation of the chosen intervals
+  uint64_t bbv_interval = 0;
+  std::string bbv_output_file;
+  uint32_t simpoint_max_k = 10;
+  std::string simpoint_file;
+  bool sampled = false;
+  uint64_t sample_warmup = 100000;
+
+  // cache options as given, shared with the tools and resolved after parsing
+  struct CacheArgs {
+    std::string write_policy = "wbwa";
+    std::string inclusion_policy = "inclusive";
+    std::string cache_model = "functional";
+    std::vector<std::string> cache_spec;
+    std::string cache_preset = "none";
+  };
+
+  // parse size (with K/M suffix support)
+  static std::size_t ParseSize(const std::string& s) {
+    std::size_t val = std::stoull(s);
+    if (s.back() == 'K' || s.back() == 'k') {
+      val = std::stoull(s.substr(0, s.size() - 1)) * 1024;
+    } else if (s.back() == 'M' || s.back() == 'm') {
+      val = std::stoull(s.substr(0, s.size() - 1)) * 1024 * 1024;
+    }
+    return val;
+  }
 
+  static void AddCacheOptions(CLI::App& app, Options& opts, CacheArgs& args) {
     // cache configuration options
     app.add_flag("--enable_cache", opts.enable_cache, "Enable cache hierarchy");
 
@@ -81,116 +116,217 @@ struct Options {
         ->default_val("cache.trace");
 
     // cache policy options
-    std::string write_policy_str = "wbwa";
-    std::string inclusion_policy_str = "inclusive";
-    std::map<std::string, WritePolicy> write_policy_map = {
-        {"wbwa", WritePolicy::WBWA}};
-    std::map<std::string, InclusionPolicy> inclusion_policy_map = {
-        {"inclusive", InclusionPolicy::Inclusive},
-        {"exclusive", InclusionPolicy::Exclusive}};
-    std::map<std::string, ReplacementPolicy> replacement_policy_map = {
-        {"lru", ReplacementPolicy::LRU}, {"random", ReplacementPolicy::Random}};
-
-    // preset cache options
-    std::vector<CacheLevelConfig> preset_cache_config = {
-        {32 * 1024, 8, 64, 4, ReplacementPolicy::LRU},
-        {256 * 1024, 8, 64, 10, ReplacementPolicy::LRU},
-        {8 * 1024 * 1024, 16, 64, 40, ReplacementPolicy::LRU},
-    };
-
-    app.add_option("--write_policy", write_policy_str,
+    app.add_option("--write_policy", args.write_policy,
                    "Write policy: wbwa (write-back/write-allocate)")
         ->check(CLI::IsMember({"wbwa"}))
         ->default_val("wbwa");
-    app.add_option("--inclusion_policy", inclusion_policy_str,
+    app.add_option("--inclusion_policy", args.inclusion_policy,
                    "Inclusion policy: inclusive, or exclusive")
         ->check(CLI::IsMember({"inclusive", "exclusive"}))
         ->default_val("inclusive");
+    app.add_option("--cache_model", args.cache_model,
+                   "Cache model: functional, or timing (tags only, same "
+                   "statistics without keeping line data)")
+        ->check(CLI::IsMember({"functional", "timing"}))
+        ->default_val("functional");
 
     // cache level specification
-    std::vector<std::string> cache_spec;
-    app.add_option("--cache_levels", cache_spec,
+    app.add_option("--cache_levels", args.cache_spec,
                    "Cache levels specification: "
                    "size,assoc,linesize,latency,replacement_policy (e.g., "
-                   "32K,8,64,4,lru for 32KB 8-way 64B-line 4-cycle lru cache). "
+                   "32K,8,64,4,lru for 32KB 8-way 64B-line 4-cycle lru cache, "
+                   "replacement_policy is lru, plru, bitplru or random). "
                    "Can specify multiple levels by repeating the option.")
         ->expected(0, 100);  // allow multiple levels
 
     // cache preset options
-    std::string cache_preset = "none";
-    app.add_option("--cache_preset", cache_preset,
+    app.add_option("--cache_preset", args.cache_preset,
                    "Cache preset: none, l1, l1l2, l1l2l3")
         ->default_val("none");
+  }
+
+  // one level of --cache_levels, "size,assoc,linesize,latency,policy"
+  static CacheLevelConfig ParseCacheSpec(const std::string& spec) {
+    std::map<std::string, ReplacementPolicy> replacement_policy_map = {
+        {"lru", ReplacementPolicy::LRU}, {"random", ReplacementPolicy::Random},
+        {"plru", ReplacementPolicy::PLRU},
+        {"bitplru", ReplacementPolicy::BitPLRU}};
 
+    std::istringstream iss(spec);
+    std::string token;
+    std::vector<std::string> tokens;
+    while (std::getline(iss, token, ',')) {
+      tokens.push_back(token);
+    }
+    if (tokens.size() != 5) {
+      throw std::runtime_error(std::format(
+          "Invalid cache spec format: {}\n"
+          "Expected: size,assoc,linesize,latency,replacement_policy\n",
+          spec));
+    }
+    if (!replacement_policy_map.contains(tokens[4])) {
+      throw std::runtime_error(std::format(
+          "Invalid cache spec format: {}\n"
+          "{} not in supported replacement policies\n",
+          spec, tokens[4]));
+    }
     try {
-      app.parse(argc, argv);
-    } catch (const CLI::ParseError& e) {
-      exit(app.exit(e));
+      return {ParseSize(tokens[0]), std::stoull(tokens[1]),
+              std::stoull(tokens[2]),
+              static_cast<uint32_t>(std::stoul(tokens[3])),
+              replacement_policy_map[tokens[4]]};
+    } catch (const std::logic_error&) {
+      // std::stoull on something not a number
+      throw std::runtime_error(std::format(
+          "Invalid cache spec format: {}\n"
+          "size, assoc, linesize and latency have to be numbers\n",
+          spec));
     }
+  }
+
+  // throws std::runtime_error for an invalid cache spec
+  static void ResolveCacheOptions(Options& opts, const CacheArgs& args) {
+    std::map<std::string, WritePolicy> write_policy_map = {
+        {"wbwa", WritePolicy::WBWA}};
+    std::map<std::string, InclusionPolicy> inclusion_policy_map = {
+        {"inclusive", InclusionPolicy::Inclusive},
+        {"exclusive", InclusionPolicy::Exclusive}};
+    std::map<std::string, CacheModel> cache_model_map = {
+        {"functional", CacheModel::Functional}, {"timing", CacheModel::Timing}};
+
+    // preset cache options
+    std::vector<CacheLevelConfig> preset_cache_config = {
+        {32 * 1024, 8, 64, 4, ReplacementPolicy::LRU},
+        {256 * 1024, 8, 64, 10, ReplacementPolicy::LRU},
+        {8 * 1024 * 1024, 16, 64, 40, ReplacementPolicy::LRU},
+    };
 
-    // after parsing
     // parse policies
-    opts.write_policy = write_policy_map[write_policy_str];
-    opts.inclusion_policy = inclusion_policy_map[inclusion_policy_str];
+    opts.write_policy = write_policy_map[args.write_policy];
+    opts.inclusion_policy = inclusion_policy_map[args.inclusion_policy];
+    opts.cache_model = cache_model_map[args.cache_model];
     // configure cache hierarchy based on preset or custom spec
-    if (!cache_spec.empty()) {
+    if (!args.cache_spec.empty()) {
       // customed cache specification
       opts.enable_cache = true;
-      // parse each level:
-      // "size,assoc,linesize,latency,replacement_policy"
-      for (const auto& spec : cache_spec) {
-        std::istringstream iss(spec);
-        std::string token;
-        std::vector<std::string> tokens;
-        while (std::getline(iss, token, ',')) {
-          tokens.push_back(token);
-        }
-        if (tokens.size() != 5) {
-          std::cerr << "Error: Invalid cache spec format: " << spec << "\n";
-          std::cerr
-              << "Expected: size,assoc,linesize,latency,replacement_policy\n";
-          exit(1);
-        }
-        // parse size (with K/M suffix support)
-        auto parse_size = [](const std::string& s) -> std::size_t {
-          std::size_t val = std::stoull(s);
-          if (s.back() == 'K' || s.back() == 'k') {
-            val = std::stoull(s.substr(0, s.size() - 1)) * 1024;
-          } else if (s.back() == 'M' || s.back() == 'm') {
-            val = std::stoull(s.substr(0, s.size() - 1)) * 1024 * 1024;
-          }
-          return val;
-        };
-
-        std::size_t size = parse_size(tokens[0]);
-        std::size_t assoc = std::stoull(tokens[1]);
-        std::size_t linesize = std::stoull(tokens[2]);
-        uint32_t latency = (tokens.size() == 4)
-                               ? std::stoul(tokens[3])
-                               : preset_cache_config[0].latency;
-        if (!replacement_policy_map.contains(tokens[4])) {
-          std::cerr << "Error: Invalid cache spec format: " << spec << "\n";
-          std::cerr << tokens[4] << " not in supported replacement policies\n";
-          exit(1);
-        }
-        auto replacement_policy = replacement_policy_map[tokens[4]];
-        opts.cache_levels.emplace_back(size, assoc, linesize, latency,
-                                       replacement_policy);
+      for (const auto& spec : args.cache_spec) {
+        opts.cache_levels.push_back(ParseCacheSpec(spec));
       }
-    } else if (opts.enable_cache || cache_preset != "none") {
+    } else if (opts.enable_cache || args.cache_preset != "none") {
       opts.enable_cache = true;
 
-      if (cache_preset == "l1") {
+      if (args.cache_preset == "l1") {
         opts.cache_levels.push_back(preset_cache_config[0]);
-      } else if (cache_preset == "l1l2") {
+      } else if (args.cache_preset == "l1l2") {
         opts.cache_levels.push_back(preset_cache_config[0]);
         opts.cache_levels.push_back(preset_cache_config[1]);
-      } else if (cache_preset == "l1l2l3") {
+      } else if (args.cache_preset == "l1l2l3") {
         opts.cache_levels.push_back(preset_cache_config[0]);
         opts.cache_levels.push_back(preset_cache_config[1]);
         opts.cache_levels.push_back(preset_cache_config[2]);
       }
     }
+  }
+
+  static Options Parse(int argc, char** argv) {
+    Options opts;
+
+    CLI::App app{"RISC-V Simulator"};
+    app.allow_extras(false);
+
+    app.add_option("-i,--input", opts.input_file, "RISC-V ELF binary file")
+        ->check(CLI::ExistingFile);
+    app.add_flag("-v,--verbose", opts.verbose, "Enable verbose output");
+    app.add_flag("-s,--single_step", opts.single_step,
+                 "Enable single-step execution");
+    app.add_flag("-d,--dump_history", opts.dump_history,
+                 "Dump execution history to dump.txt");
+    app.add_option("--memory_size", opts.memory_size,
+                   "Memory size in bytes, at most 4G")
+        ->default_val(opts.memory_size)
+        ->check(CLI::Range(uint64_t(1), uint64_t(1) << 32));
+    app.add_option("--pipeline_mode", opts.pipeline_mode, "Pipeline mode")
+        ->default_val(opts.pipeline_mode)
+        ->check(CLI::IsMember(pipeline_modes));
+
+    // cache, latency and cache trace options
+    CacheArgs cache_args;
+    AddCacheOptions(app, opts, cache_args);
+
+    // access trace options
+    app.add_option("--mem_trace", opts.mem_trace_file,
+                   "Record every memory access of the detailed simulation "
+                   "into a compact binary trace file");
+
+    // fast-forward options
+    app.add_option("--fast_forward", opts.fast_forward,
+                   "Functionally execute N instructions before the detailed "
+                   "simulation");
+    app.add_option("--fast_forward_until", opts.fast_forward_until,
+                   "Functionally execute until reaching the given PC");
+    app.add_flag("--jit", opts.jit,
+                 "Translate hot blocks to x86-64 code when fast-forwarding");
+    app.add_flag("--jit_check", opts.jit_check,
+                 "Cross-check every translated block against the interpreter "
+                 "(cache statistics then count both runs)");
+
+    // checkpoint options
+    app.add_option("--checkpoint_out", opts.checkpoint_out,
+                   "Save the state after fast-forwarding to a checkpoint file");
+    app.add_option("--checkpoint_in", opts.checkpoint_in,
+                   "Start from a checkpoint file instead of the ELF binary")
+        ->check(CLI::ExistingFile);
+    app.add_flag("--checkpoint_cache", opts.checkpoint_cache,
+                 "Also save the cache contents into the checkpoint");
+    app.add_option("--shared_image", opts.shared_image,
+                   "Start from a memory image shared copy-on-write by all "
+                   "runs using it, created from the ELF binary if missing");
+
+    // simulation point options
+    app.add_option("--bbv_interval", opts.bbv_interval,
+                   "Profile basic block vectors every N instructions and "
+                   "choose simulation points, without detailed simulation");
+    app.add_option("--bbv", opts.bbv_output_file,
+                   "Basic block vector output file")
+        ->default_val("bbv.out");
+    app.add_option("--simpoint_max_k", opts.simpoint_max_k,
+                   "Maximum number of simulation points")
+        ->default_val(opts.simpoint_max_k);
+    app.add_option("--simpoints", opts.simpoint_file,
+                   "Simulation point file written by --bbv_interval")
+        ->default_val("simpoints.out");
+    app.add_flag("--sampled", opts.sampled,
+                 "Simulate only the simulation points in detail and report "
+                 "weighted statistics");
+    app.add_option("--sample_warmup", opts.sample_warmup,
+                   "Detailed warm-up instructions before each simulation "
+                   "point")
+        ->default_val(opts.sample_warmup);
+
+    try {
+      app.parse(argc, argv);
+    } catch (const CLI::ParseError& e) {
+      exit(app.exit(e));
+    }
+    if (opts.input_file.empty() && opts.checkpoint_in.empty() &&
+        opts.shared_image.empty()) {
+      std::cerr
+          << "Error: --input, --checkpoint_in or --shared_image is required\n";
+      exit(1);
+    }
+    // both say where the run starts from
+    if (!opts.checkpoint_in.empty() && !opts.shared_image.empty()) {
+      std::cerr << "Error: --checkpoint_in and --shared_image cannot be used "
+                   "together\n";
+      exit(1);
+    }
+
+    try {
+      ResolveCacheOptions(opts, cache_args);
+    } catch (const std::runtime_error& e) {
+      std::cerr << "Error: " << e.what();
+      exit(1);
+    }
 
     return opts;
   }
@@ -0,0 +1,259 @@
+#include "simpoint.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <numbers>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace SimPoint {
+
+namespace {
+
+// dimensions the vectors are randomly projected down to
+constexpr uint32_t DIM = 15;
+constexpr uint32_t MAX_ITERATIONS = 100;
+// k-means runs per k, the one with the least error is kept
+constexpr uint32_t RESTARTS = 5;
+constexpr uint64_t SEED = 0x5eed;
+
+using Vec = std::array<double, DIM>;
+
+// entry of the projection matrix in [-1, 1), hashed from its position so
+// the matrix is never stored
+double Projection(uint32_t id, uint32_t dim) {
+  uint64_t x = SEED + (uint64_t)id * DIM + dim + 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return (x >> 11) * 0x1.0p-52 - 1.0;
+}
+
+double Distance2(const Vec& a, const Vec& b) {
+  double sum = 0;
+  for (uint32_t d = 0; d < DIM; ++d) {
+    sum += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return sum;
+}
+
+struct Clustering {
+  std::vector<Vec> centers;
+  std::vector<uint32_t> assign;
+  double error = 0;  // sum of squared distances to the centers
+};
+
+Clustering KMeans(const std::vector<Vec>& points, uint32_t k,
+                  std::mt19937_64& rng) {
+  const size_t n = points.size();
+  Clustering result;
+
+  // k-means++ seeding
+  result.centers.push_back(points[rng() % n]);
+  std::vector<double> d2(n, std::numeric_limits<double>::max());
+  while (result.centers.size() < k) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      d2[i] = std::min(d2[i], Distance2(points[i], result.centers.back()));
+      sum += d2[i];
+    }
+    if (sum == 0) {
+      break;  // fewer distinct points than k
+    }
+    double r = std::uniform_real_distribution<double>(0, sum)(rng);
+    size_t i = 0;
+    while (i + 1 < n && (r -= d2[i]) >= 0) {
+      ++i;
+    }
+    result.centers.push_back(points[i]);
+  }
+
+  const size_t num = result.centers.size();
+  result.assign.assign(n, num);
+  for (uint32_t iter = 0; iter < MAX_ITERATIONS; ++iter) {
+    bool changed = false;
+    result.error = 0;
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t best = 0;
+      double best_d2 = Distance2(points[i], result.centers[0]);
+      for (uint32_t c = 1; c < num; ++c) {
+        double dist = Distance2(points[i], result.centers[c]);
+        if (dist < best_d2) {
+          best = c;
+          best_d2 = dist;
+        }
+      }
+      changed |= result.assign[i] != best;
+      result.assign[i] = best;
+      result.error += best_d2;
+    }
+    if (!changed) {
+      break;
+    }
+
+    // an emptied cluster keeps its old center
+    std::vector<Vec> sums(num, Vec{});
+    std::vector<uint64_t> counts(num, 0);
+    for (size_t i = 0; i < n; ++i) {
+      for (uint32_t d = 0; d < DIM; ++d) {
+        sums[result.assign[i]][d] += points[i][d];
+      }
+      counts[result.assign[i]]++;
+    }
+    for (uint32_t c = 0; c < num; ++c) {
+      if (counts[c] > 0) {
+        for (uint32_t d = 0; d < DIM; ++d) {
+          result.centers[c][d] = sums[c][d] / counts[c];
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// Bayesian information criterion of spherical Gaussians around the centers
+double Bic(const Clustering& clustering, size_t n) {
+  const double r = n;
+  const double k = clustering.centers.size();
+  std::vector<uint64_t> sizes(clustering.centers.size(), 0);
+  for (uint32_t c : clustering.assign) {
+    sizes[c]++;
+  }
+
+  double variance = n > k ? clustering.error / (DIM * (r - k)) : 0;
+  variance = std::max(variance, 1e-12);
+  double likelihood = -0.5 * DIM * (r - k);
+  for (uint64_t size : sizes) {
+    if (size > 0) {
+      likelihood += size * std::log(size / r) -
+                    size * DIM / 2.0 *
+                        std::log(2 * std::numbers::pi * variance);
+    }
+  }
+  double params = (k - 1) + DIM * k + 1;
+  return likelihood - params / 2 * std::log(r);
+}
+
+}  // namespace
+
+std::vector<Point> Choose(const std::vector<Bbv>& bbvs, uint32_t max_k) {
+  if (bbvs.empty()) {
+    return {};
+  }
+
+  // normalized to sum to one, then projected
+  std::vector<Vec> points;
+  for (const auto& bbv : bbvs) {
+    double total = 0;
+    for (const auto& [id, count] : bbv) {
+      total += count;
+    }
+    Vec point{};
+    for (const auto& [id, count] : bbv) {
+      for (uint32_t d = 0; d < DIM; ++d) {
+        point[d] += count / total * Projection(id, d);
+      }
+    }
+    points.push_back(point);
+  }
+
+  std::mt19937_64 rng(SEED);
+  std::vector<Clustering> results;
+  std::vector<double> bics;
+  uint32_t k_num = std::min<uint64_t>(std::max(max_k, 1U), points.size());
+  for (uint32_t k = 1; k <= k_num; ++k) {
+    Clustering best;
+    for (uint32_t i = 0; i < RESTARTS; ++i) {
+      Clustering clustering = KMeans(points, k, rng);
+      if (i == 0 || clustering.error < best.error) {
+        best = std::move(clustering);
+      }
+    }
+    bics.push_back(Bic(best, points.size()));
+    results.push_back(std::move(best));
+  }
+
+  auto [min_bic, max_bic] = std::minmax_element(bics.begin(), bics.end());
+  double threshold = *min_bic + 0.9 * (*max_bic - *min_bic);
+  size_t chosen = 0;
+  while (bics[chosen] < threshold) {
+    ++chosen;
+  }
+  const Clustering& clustering = results[chosen];
+
+  // the interval closest to each center stands for its cluster
+  std::vector<Point> result;
+  for (uint32_t c = 0; c < clustering.centers.size(); ++c) {
+    uint64_t size = 0;
+    uint64_t closest = 0;
+    double closest_d2 = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (clustering.assign[i] != c) {
+        continue;
+      }
+      size++;
+      double dist = Distance2(points[i], clustering.centers[c]);
+      if (dist < closest_d2) {
+        closest = i;
+        closest_d2 = dist;
+      }
+    }
+    if (size > 0) {
+      result.push_back({closest, (double)size / points.size()});
+    }
+  }
+  std::sort(result.begin(), result.end(),
+            [](const Point& a, const Point& b) {
+              return a.interval < b.interval;
+            });
+  return result;
+}
+
+void Write(const std::string& path, uint64_t interval,
+           const std::vector<Point>& points) {
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error(std::format("Cannot write {}\n", path));
+  }
+  out << std::format("# interval {}\n", interval);
+  for (const auto& point : points) {
+    out << std::format("{} {:.6f}\n", point.interval, point.weight);
+  }
+}
+
+std::vector<Point> Read(const std::string& path, uint64_t* interval) {
+  std::ifstream in(path);
+  std::string line;
+  if (!in || !std::getline(in, line) ||
+      std::sscanf(line.c_str(), "# interval %lu", interval) != 1 ||
+      *interval == 0) {
+    throw std::runtime_error(
+        std::format("{} is not a simulation point file\n", path));
+  }
+
+  std::vector<Point> points;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream iss(line);
+    Point point;
+    if (!(iss >> point.interval >> point.weight)) {
+      throw std::runtime_error(
+          std::format("Bad simulation point in {}: {}\n", path, line));
+    }
+    points.push_back(point);
+  }
+  std::sort(points.begin(), points.end(),
+            [](const Point& a, const Point& b) {
+              return a.interval < b.interval;
+            });
+  return points;
+}
+
+}  // namespace SimPoint
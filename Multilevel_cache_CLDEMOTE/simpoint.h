@@ -0,0 +1,33 @@
+#ifndef SRC_SIMPOINT_H
+#define SRC_SIMPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// SimPoint-style phase analysis: basic block vectors of fixed instruction
+// intervals are clustered, and one interval per cluster stands for it
+namespace SimPoint {
+
+// non-zero entries of one interval, (block id, instructions executed)
+using Bbv = std::vector<std::pair<uint32_t, uint64_t>>;
+
+struct Point {
+  uint64_t interval;  // index of the interval standing for its cluster
+  double weight;      // fraction of all intervals in the cluster
+};
+
+// cluster `bbvs` with k-means for k up to `max_k`, and keep the smallest k
+// scoring within 90% of the best BIC, as SimPoint does. points come back
+// sorted by interval
+std::vector<Point> Choose(const std::vector<Bbv>& bbvs, uint32_t max_k);
+
+// `interval` is the number of instructions per interval
+void Write(const std::string& path, uint64_t interval,
+           const std::vector<Point>& points);
+std::vector<Point> Read(const std::string& path, uint64_t* interval);
+
+}  // namespace SimPoint
+
+#endif
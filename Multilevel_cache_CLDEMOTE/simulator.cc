@@ -1,23 +1,111 @@
 #include "simulator.h"
 
+#include <unistd.h>
+
 #include <cassert>
 #include <cstdarg>
 #include <cstdint>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "checkpoint.h"
 #include "elf_reader.h"
 #include "five_stage_simulator.h"
+#include "jit.h"
 #include "memory_manager.h"
 #include "riscv.h"
+#include "simpoint.h"
+
+namespace {
+
+// what a shared image is built from, so that a stale one is not run for
+// another program. empty without --input, then any image is taken
+std::string ImageSource(const Options& opts) {
+  if (opts.input_file.empty()) {
+    return {};
+  }
+  namespace fs = std::filesystem;
+  fs::path elf = fs::canonical(opts.input_file);
+  return std::format("{} {} {} {}", elf.string(), fs::file_size(elf),
+                     fs::last_write_time(elf).time_since_epoch().count(),
+                     opts.memory_size);
+}
+
+// the source an image was built from, `in` is advanced to its checkpoint
+std::string ReadImageSource(std::span<const uint8_t>& in,
+                            const std::string& path) {
+  using namespace Checkpoint;
+  if (in.size() < sizeof(IMAGE_MAGIC) ||
+      std::memcmp(Take(in, sizeof(IMAGE_MAGIC)).data(), IMAGE_MAGIC,
+                  sizeof(IMAGE_MAGIC)) != 0) {
+    throw std::runtime_error(std::format("{} is not a shared image\n", path));
+  }
+  auto bytes = Take(in, Get<uint32_t>(in));
+  return std::string(bytes.begin(), bytes.end());
+}
+
+// false if the image has to be created first
+bool ImageCurrent(const std::string& path, const std::string& source) {
+  if (!std::filesystem::exists(path)) {
+    return false;
+  }
+  Checkpoint::MappedFile file(path);
+  std::span<const uint8_t> in = file.Data();
+  return source.empty() || ReadImageSource(in, path) == source;
+}
+
+}  // namespace
 
 Simulator::Simulator(const Options& opts)
     : single_step_(opts.single_step),
       verbose_(opts.verbose),
-      dump_history_(opts.dump_history) {
-  memory_ = std::make_unique<MemoryManager>(opts);
+      dump_history_(opts.dump_history),
+      jit_(opts.jit),
+      jit_check_(opts.jit_check) {
+  // an image of another program or build is replaced
+  std::string source;
+  if (!opts.shared_image.empty()) {
+    try {
+      source = ImageSource(opts);
+      if (!ImageCurrent(opts.shared_image, source)) {
+        CreateSharedImage(opts, source);
+      }
+    } catch (const std::exception& e) {
+      Panic(e.what());
+    }
+  }
+
+  try {
+    memory_ = std::make_unique<MemoryManager>(opts);
+  } catch (const std::exception& e) {
+    Panic(e.what());
+  }
+  if (!opts.checkpoint_in.empty()) {
+    try {
+      LoadCheckpoint(opts.checkpoint_in);
+    } catch (const std::exception& e) {
+      Panic(e.what());
+    }
+    return;
+  }
+
+  if (!opts.shared_image.empty()) {
+    try {
+      LoadSharedImage(opts.shared_image, source);
+    } catch (const std::exception& e) {
+      Panic(e.what());
+    }
+    return;
+  }
+  LoadElf(opts);
+}
+
+void Simulator::LoadElf(const Options& opts) {
   auto elf_reader = ElfReader(opts.input_file, opts.verbose);
   elf_reader.LoadElfToMemory(memory_.get());
   pc_ = elf_reader.GetEntry();
@@ -29,15 +117,299 @@ Simulator::Simulator(const Options& opts)
   InitStack(stack_base, stack_size);
 }
 
+void Simulator::CreateSharedImage(const Options& opts,
+                                  const std::string& source) {
+  using namespace Checkpoint;
+  if (opts.input_file.empty()) {
+    throw std::runtime_error(std::format(
+        "{} does not exist, --input is needed to create it\n",
+        opts.shared_image));
+  }
+  // in plain memory, the image holds no cache state
+  Options plain = opts;
+  plain.enable_cache = false;
+  plain.mem_trace_file.clear();
+  memory_ = std::make_unique<MemoryManager>(plain);
+  LoadElf(opts);
+  // renamed into place, runs starting at the same time may race to create
+  // it and none of them must map a partial file
+  std::string tmp = std::format("{}.{}.tmp", opts.shared_image, getpid());
+  std::ofstream out(tmp, std::ios::binary);
+  if (!out) {
+    throw std::runtime_error(std::format("Cannot write shared image {}\n", tmp));
+  }
+  out.write(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  Put<uint32_t>(out, source.size());
+  out.write(source.data(), source.size());
+  WriteCheckpoint(out, false);
+  if (!out.flush()) {
+    throw std::runtime_error(std::format("Cannot write shared image {}\n", tmp));
+  }
+  out.close();
+  std::filesystem::rename(tmp, opts.shared_image);
+}
+
 std::unique_ptr<Simulator> Simulator::Create(const Options& opts) {
+  std::unique_ptr<Simulator> simulator;
   if (opts.pipeline_mode == "five-stage") {
     // for simplicity since base class shouldn't know its successor
-    return std::make_unique<FiveStageSimulator>(opts);
+    // tracing is compiled out unless it is asked for
+    if (opts.verbose || opts.single_step) {
+      simulator = std::make_unique<FiveStageSimulator<DebugTrace>>(opts);
+    } else {
+      simulator = std::make_unique<FiveStageSimulator<NoTrace>>(opts);
+    }
   } else {
     // shouldn't reach here since abnormal inputs are handled when parsing
     std::cerr << std::format("Unknown pipeline mode {}\n", opts.pipeline_mode);
     exit(1);
   }
+
+  // hand the architectural state over to the pipeline afterwards
+  if (opts.fast_forward > 0 || opts.fast_forward_until > 0) {
+    uint64_t max_insts = opts.fast_forward > 0
+                             ? opts.fast_forward
+                             : std::numeric_limits<uint64_t>::max();
+    uint64_t count = simulator->FastForward(max_insts, opts.fast_forward_until);
+    printf("Fast-forwarded %lu instructions to pc 0x%lx\n", count,
+           simulator->pc_);
+  }
+  if (!opts.checkpoint_out.empty()) {
+    try {
+      simulator->SaveCheckpoint(opts.checkpoint_out, opts.checkpoint_cache);
+    } catch (const std::exception& e) {
+      simulator->Panic(e.what());
+    }
+    printf("Checkpoint at pc 0x%lx saved to %s\n", simulator->pc_,
+           opts.checkpoint_out.c_str());
+  }
+
+  // both modes replace the normal run
+  if (opts.bbv_interval > 0) {
+    simulator->Profile(opts);
+    simulator->FlushTrace();
+    exit(0);
+  }
+  if (opts.sampled) {
+    simulator->RunSampled(opts);
+    simulator->FlushTrace();
+    exit(0);
+  }
+  return simulator;
+}
+
+FunctionalEngine* Simulator::GetEngine() {
+  if (!engine_) {
+    if ((jit_ || jit_check_) && !Jit::Supported()) {
+      std::cerr << "JIT is not supported on this host, interpreting instead\n";
+    }
+    engine_ = std::make_unique<FunctionalEngine>(
+        memory_.get(), stack_base_ - stack_size_, jit_, jit_check_);
+  }
+  return engine_.get();
+}
+
+uint64_t Simulator::FastForward(uint64_t max_insts, uint64_t until_pc) {
+  bool exited = false;
+  uint64_t count = 0;
+  // the engine does not tell the pc of its accesses
+  memory_->Trace(false);
+  try {
+    count = GetEngine()->Run(pc_, regs_, max_insts, until_pc, &exited);
+  } catch (const std::exception& e) {
+    Panic(e.what());
+  }
+  memory_->Trace(true);
+  if (exited) {
+    printf("Program exit from an exit() system call\n");
+    printf("Fast-forwarded %lu instructions\n", count);
+    memory_->PrintStatistics();
+    FlushTrace();
+    exit(0);
+  }
+  return count;
+}
+
+void Simulator::Profile(const Options& opts) {
+  std::ofstream bbv_file(opts.bbv_output_file);
+  if (!bbv_file) {
+    Panic("Cannot write %s\n", opts.bbv_output_file.c_str());
+  }
+
+  FunctionalEngine* engine = GetEngine();
+  std::vector<uint64_t> bbv;
+  std::vector<SimPoint::Bbv> bbvs;
+  uint64_t total = 0;
+  // the engine does not tell the pc of its accesses
+  memory_->Trace(false);
+  engine->Profile(&bbv);
+  while (true) {
+    bool exited = false;
+    uint64_t count = 0;
+    try {
+      count = engine->Run(pc_, regs_, opts.bbv_interval, 0, &exited);
+    } catch (const std::exception& e) {
+      Panic(e.what());
+    }
+    total += count;
+    // the interval the program exits in is dropped, so simulating any
+    // chosen interval never reaches the exit
+    if (exited || count < opts.bbv_interval) {
+      break;
+    }
+
+    // SimPoint's format, block ids start from 1
+    auto& sparse = bbvs.emplace_back();
+    bbv_file << "T";
+    for (uint32_t id = 0; id < bbv.size(); ++id) {
+      if (bbv[id] > 0) {
+        sparse.emplace_back(id, bbv[id]);
+        bbv_file << std::format(":{}:{} ", id + 1, bbv[id]);
+      }
+    }
+    bbv_file << "\n";
+    std::fill(bbv.begin(), bbv.end(), 0);
+  }
+  engine->Profile(nullptr);
+  memory_->Trace(true);
+
+  auto points = SimPoint::Choose(bbvs, opts.simpoint_max_k);
+  try {
+    SimPoint::Write(opts.simpoint_file, opts.bbv_interval, points);
+  } catch (const std::exception& e) {
+    Panic(e.what());
+  }
+  printf("Profiled %lu instructions, %lu intervals of %lu\n", total,
+         bbvs.size(), opts.bbv_interval);
+  for (const auto& point : points) {
+    printf("Simulation point at interval %lu, weight %.4f\n", point.interval,
+           point.weight);
+  }
+  printf("Simulation points saved to %s\n", opts.simpoint_file.c_str());
+}
+
+void Simulator::RunSampled(const Options& opts) {
+  uint64_t interval = 0;
+  std::vector<SimPoint::Point> points;
+  try {
+    points = SimPoint::Read(opts.simpoint_file, &interval);
+  } catch (const std::exception& e) {
+    Panic(e.what());
+  }
+
+  // weighted sums over the points
+  double weights = 0;
+  double cpi = 0;
+  size_t level_num = memory_->GetStatistics().size();
+  std::vector<double> accesses(level_num, 0);
+  std::vector<double> misses(level_num, 0);
+
+  // instructions executed so far, functionally or in detail
+  uint64_t executed = 0;
+  for (const auto& point : points) {
+    uint64_t start = point.interval * interval;
+    uint64_t warm_start =
+        std::max(executed, start - std::min(start, opts.sample_warmup));
+    if (warm_start > executed) {
+      if (engine_) {
+        // the pipeline may have changed code behind the engine
+        engine_->Flush();
+      }
+      executed += FastForward(warm_start - executed, 0);
+    }
+    if (start > executed) {
+      SimulateInsts(start - executed);
+      executed = start;
+    }
+
+    auto before = memory_->GetStatistics();
+    uint64_t cycles = SimulateInsts(interval);
+    executed += interval;
+    auto after = memory_->GetStatistics();
+
+    double point_cpi = (double)cycles / interval;
+    printf("Simulation point at interval %lu, weight %.4f: CPI %.4f\n",
+           point.interval, point.weight, point_cpi);
+    weights += point.weight;
+    cpi += point.weight * point_cpi;
+    for (size_t i = 0; i < after.size(); ++i) {
+      accesses[i] += point.weight * (after[i].accesses - before[i].accesses);
+      misses[i] += point.weight * (after[i].misses - before[i].misses);
+    }
+  }
+  if (weights == 0) {
+    Panic("No simulation point in %s\n", opts.simpoint_file.c_str());
+  }
+
+  printf("------------ SAMPLED STATISTICS -----------\n");
+  printf("Simulation Points: %lu of %lu instructions each\n", points.size(),
+         interval);
+  printf("Weighted Cycles per Instruction: %.4f\n", cpi / weights);
+  for (size_t i = 0; i < accesses.size(); ++i) {
+    double hit_rate = accesses[i] == 0 ? 0 : 1 - misses[i] / accesses[i];
+    printf("L%lu Weighted Hit Rate: %.2f%%, MPKI: %.4f\n", i + 1,
+           hit_rate * 100, misses[i] / weights / interval * 1000);
+  }
+  printf("-------------------------------------------\n");
+}
+
+void Simulator::SaveCheckpoint(const std::string& path, bool with_cache) {
+  using namespace Checkpoint;
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    throw std::runtime_error(std::format("Cannot write checkpoint {}\n", path));
+  }
+  WriteCheckpoint(out, with_cache);
+  if (!out.flush()) {
+    throw std::runtime_error(std::format("Cannot write checkpoint {}\n", path));
+  }
+}
+
+void Simulator::WriteCheckpoint(std::ostream& out, bool with_cache) {
+  using namespace Checkpoint;
+  out.write(MAGIC, sizeof(MAGIC));
+  Put(out, pc_);
+  Put(out, regs_);
+  Put(out, stack_base_);
+  Put(out, stack_size_);
+  memory_->SaveState(out, with_cache);
+}
+
+void Simulator::LoadCheckpoint(const std::string& path) {
+  auto file = std::make_unique<Checkpoint::MappedFile>(path);
+  std::span<const uint8_t> in = file->Data();
+  RestoreCheckpoint(path, std::move(file), in, false);
+}
+
+void Simulator::LoadSharedImage(const std::string& path,
+                                const std::string& source) {
+  auto file = std::make_unique<Checkpoint::MappedFile>(path);
+  std::span<const uint8_t> in = file->Data();
+  // another run may have replaced it since it was checked
+  std::string built = ReadImageSource(in, path);
+  if (!source.empty() && built != source) {
+    throw std::runtime_error(std::format(
+        "{} was replaced by an image of another program\n", path));
+  }
+  RestoreCheckpoint(path, std::move(file), in, true);
+}
+
+void Simulator::RestoreCheckpoint(const std::string& path,
+                                  std::unique_ptr<Checkpoint::MappedFile> file,
+                                  std::span<const uint8_t> in, bool share) {
+  using namespace Checkpoint;
+  if (in.size() < sizeof(MAGIC) ||
+      std::memcmp(Take(in, sizeof(MAGIC)).data(), MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::runtime_error(std::format("{} is not a checkpoint\n", path));
+  }
+  pc_ = Get<uint64_t>(in);
+  regs_ = Get<RISCV::Regs>(in);
+  stack_base_ = Get<uint32_t>(in);
+  stack_size_ = Get<uint32_t>(in);
+  memory_->RestoreState(in, share);
+  if (share) {
+    image_ = std::move(file);
+  }
 }
 
 void Simulator::Panic(const char* format, ...) const {
@@ -49,6 +421,7 @@ void Simulator::Panic(const char* format, ...) const {
   va_end(args);
   DumpHistory();
   fprintf(stderr, "Execution history in dump.txt\n");
+  FlushTrace();
   exit(1);
 }
 
@@ -56,14 +429,26 @@ void Simulator::Panic(std::string_view str_view) const {
   std::cerr << str_view;
   DumpHistory();
   std::cerr << "Execution history in dump.txt\n";
+  FlushTrace();
   exit(1);
 }
 
+void Simulator::FlushTrace() const {
+  if (!memory_) {
+    return;
+  }
+  try {
+    memory_->Flush();
+  } catch (const std::exception& e) {
+    std::cerr << e.what();
+    exit(1);
+  }
+}
+
 void Simulator::InitStack(uint32_t stack_base, uint32_t stack_size) {
   regs_[RISCV::REG_SP] = stack_base;
   stack_base_ = stack_base;
   stack_size_ = stack_size;
-  for (uint32_t addr = stack_base; addr > stack_base - stack_size; addr--) {
-    memory_->SetByte(addr, 0);
-  }
+  // (stack_base - stack_size, stack_base], normally still untouched
+  memory_->Zero(stack_base - stack_size + 1, stack_size);
 }
@@ -3,7 +3,12 @@
 
 #include <array>
 #include <memory>
+#include <span>
+#include <string>
 
+#include "checkpoint.h"
+#include "decode_cache.h"
+#include "functional_engine.h"
 #include "memory_manager.h"
 #include "options.h"
 #include "riscv.h"
@@ -14,14 +19,49 @@ class Simulator {
   RISCV::Regs regs_{};
   uint32_t stack_base_ = 0;
   uint32_t stack_size_ = 0;
+  // shared image the pages of memory_ point into, so declared before it
+  std::unique_ptr<Checkpoint::MappedFile> image_ = nullptr;
   std::unique_ptr<MemoryManager> memory_ = nullptr;
+  DecodeCache decode_cache_;
+  // created on the first fast-forward
+  std::unique_ptr<FunctionalEngine> engine_ = nullptr;
 
   bool single_step_ = false;
   bool verbose_ = false;
   bool dump_history_ = false;
+  bool jit_ = false;
+  bool jit_check_ = false;
 
+  // load the ELF binary and set up the stack
+  void LoadElf(const Options& opts);
   void InitStack(uint32_t stack_base, uint32_t stack_size);
+  FunctionalEngine* GetEngine();
+  // run the ISA without the pipeline model for at most `max_insts`
+  // instructions or until pc_ reaches `until_pc`, return the count executed
+  uint64_t FastForward(uint64_t max_insts, uint64_t until_pc);
+  // pc, registers, stack bounds and memory, `with_cache` adds the caches
+  void SaveCheckpoint(const std::string& path, bool with_cache);
+  void WriteCheckpoint(std::ostream& out, bool with_cache);
+  void LoadCheckpoint(const std::string& path);
+  // `in` is the checkpoint within `file`, read from `path`. `share` keeps
+  // the file mapped and its pages shared copy-on-write
+  void RestoreCheckpoint(const std::string& path,
+                         std::unique_ptr<Checkpoint::MappedFile> file,
+                         std::span<const uint8_t> in, bool share);
+  // a checkpoint of the program before its first instruction, tagged with
+  // `source`, leaves memory_ to be replaced
+  void CreateSharedImage(const Options& opts, const std::string& source);
+  // fails if the image is not built from `source`, unless that is empty
+  void LoadSharedImage(const std::string& path, const std::string& source);
+  // write the basic block vector of every interval and the simulation
+  // points chosen from them
+  void Profile(const Options& opts);
+  // simulate the simulation points in detail, fast-forwarding in between
+  void RunSampled(const Options& opts);
   virtual void DumpHistory() const {};
+  // write out the access and cache traces before exit(), which skips
+  // destructors
+  void FlushTrace() const;
   void Panic(const char* format, ...) const;
   void Panic(std::string_view str_view) const;
 
@@ -30,12 +70,16 @@ class Simulator {
   virtual ~Simulator() = default;
 
   virtual void Run() = 0;
+  // simulate exactly `n` instructions in detail and drain the pipeline,
+  // leaving pc_ at the next instruction. returns the cycles taken
+  virtual uint64_t SimulateInsts(uint64_t n) = 0;
 
   // factory method for future pipeline modes
   static std::unique_ptr<Simulator> Create(const Options& opts);
 };
 
 // forward declaration
+template <typename Policy>
 class FiveStageSimulator;
 
 #endif
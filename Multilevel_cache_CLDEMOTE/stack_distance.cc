@@ -0,0 +1,157 @@
+#include "stack_distance.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+// slots the Fenwick tree starts with and at least keeps after compacting
+constexpr uint32_t MIN_SLOTS = 1 << 16;
+}  // namespace
+
+StackDistance::StackDistance(uint32_t line_size, uint64_t max_size)
+    : tree_(MIN_SLOTS + 1), line_bits_(std::countr_zero(line_size)) {
+  if (!std::has_single_bit(line_size)) {
+    throw std::runtime_error(
+        std::format("Line size {} is not a power of 2\n", line_size));
+  }
+  for (uint64_t sets = 1; sets * line_size <= max_size; sets *= 2) {
+    uint32_t depth = std::min<uint64_t>(MAX_WAYS, max_size / (sets * line_size));
+    sets_.push_back({static_cast<uint32_t>(sets - 1), depth,
+                     std::vector<uint32_t>(sets * depth),
+                     std::vector<uint64_t>(depth)});
+  }
+}
+
+void StackDistance::Add(uint32_t slot, int32_t delta) {
+  for (uint32_t i = slot + 1; i < tree_.size(); i += i & -i) {
+    tree_[i] += delta;
+  }
+}
+
+uint32_t StackDistance::Prefix(uint32_t slot) const {
+  uint32_t sum = 0;
+  for (uint32_t i = slot + 1; i > 0; i -= i & -i) {
+    sum += tree_[i];
+  }
+  return sum;
+}
+
+void StackDistance::Compact() {
+  // only the marked slots matter, renumber them in order
+  std::vector<std::pair<uint32_t, uint32_t>> marked;
+  marked.reserve(last_slot_.size());
+  for (const auto& [line, slot] : last_slot_) {
+    marked.emplace_back(slot, line);
+  }
+  std::sort(marked.begin(), marked.end());
+  uint32_t num = marked.size();
+  for (uint32_t i = 0; i < num; ++i) {
+    last_slot_[marked[i].second] = i;
+  }
+  next_slot_ = num;
+
+  // slots 0 .. num-1 are marked, node i covers (i - lowbit(i), i]
+  tree_.assign(std::max(2 * num, MIN_SLOTS) + 1, 0);
+  for (uint32_t i = 1; i < tree_.size(); ++i) {
+    uint32_t lo = i - (i & -i);
+    tree_[i] = lo < num ? std::min(i, num) - lo : 0;
+  }
+}
+
+void StackDistance::AccessLine(uint32_t line) {
+  accesses_++;
+
+  if (next_slot_ + 1 == tree_.size()) {
+    Compact();
+  }
+  auto [it, cold] = last_slot_.try_emplace(line, next_slot_);
+  if (cold) {
+    cold_++;
+  } else {
+    // lines marked after the last access to this one
+    uint64_t distance = last_slot_.size() - Prefix(it->second);
+    if (distance >= hist_.size()) {
+      hist_.resize(distance + 1);
+    }
+    hist_[distance]++;
+    Add(it->second, -1);
+    it->second = next_slot_;
+  }
+  Add(next_slot_++, 1);
+
+  uint32_t tag = line + 1;
+  for (SetStacks& level : sets_) {
+    uint32_t* stack = &level.lines[(line & level.set_mask) * level.depth];
+    uint32_t pos = 0;
+    while (pos < level.depth && stack[pos] != tag) {
+      pos++;
+    }
+    if (pos < level.depth) {
+      level.hits[pos]++;
+    } else {
+      level.deeper++;
+      pos = level.depth - 1;
+    }
+    std::move_backward(stack, stack + pos, stack + pos + 1);
+    stack[0] = tag;
+  }
+}
+
+void StackDistance::Access(uint32_t addr, uint32_t size) {
+  uint32_t first = addr >> line_bits_;
+  uint32_t last = (addr + size - 1) >> line_bits_;
+  for (uint32_t line = first; line <= last; ++line) {
+    AccessLine(line);
+  }
+}
+
+uint64_t StackDistance::Misses(uint64_t lines) const {
+  uint64_t misses = accesses_;
+  for (uint64_t d = 0; d < std::min<uint64_t>(lines, hist_.size()); ++d) {
+    misses -= hist_[d];
+  }
+  return misses;
+}
+
+uint64_t StackDistance::Misses(uint64_t sets, uint32_t ways) const {
+  const SetStacks& level = sets_.at(std::countr_zero(sets));
+  uint64_t misses = level.deeper;
+  for (uint32_t pos = ways; pos < level.depth; ++pos) {
+    misses += level.hits[pos];
+  }
+  return misses;
+}
+
+void StackDistance::Print(std::ostream& out) const {
+  uint64_t line_size = uint64_t(1) << line_bits_;
+  auto ratio = [&](uint64_t misses) {
+    return accesses_ == 0 ? 0.0 : (double)misses / accesses_;
+  };
+
+  out << std::format("# {} accesses to {} lines of {} bytes\n", accesses_,
+                     Footprint(), line_size);
+  out << "# fully associative LRU\n";
+  out << "# size misses miss_ratio\n";
+  // past the footprint only cold misses are left
+  uint64_t lines = 1;
+  for (; lines < Footprint(); lines *= 2) {
+    uint64_t misses = Misses(lines);
+    out << std::format("{} {} {:.6f}\n", lines * line_size, misses,
+                       ratio(misses));
+  }
+  out << std::format("{} {} {:.6f}\n", lines * line_size, cold_, ratio(cold_));
+
+  out << "# set associative LRU\n";
+  out << "# size sets ways misses miss_ratio\n";
+  for (const SetStacks& level : sets_) {
+    uint64_t sets = uint64_t(level.set_mask) + 1;
+    for (uint32_t ways = 1; ways <= level.depth; ++ways) {
+      uint64_t misses = Misses(sets, ways);
+      out << std::format("{} {} {} {} {:.6f}\n", sets * ways * line_size, sets,
+                         ways, misses, ratio(misses));
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef SRC_STACK_DISTANCE_H
+#define SRC_STACK_DISTANCE_H
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// LRU stack distances of a stream of accesses at one line size (Mattson et
+// al.), from which the misses of every LRU cache of that line size follow
+// in a single pass. an access hits in a cache of n lines exactly when
+// fewer than n other lines were touched since its line was last touched.
+// fully associative distances are counted with a Fenwick tree over access
+// slots, set associative ones with a short LRU stack per set for every
+// power-of-2 number of sets
+class StackDistance {
+ public:
+  // associativities up to this are reported
+  static constexpr uint32_t MAX_WAYS = 32;
+
+ private:
+  // fully associative: one marked slot per line, its last access
+  std::unordered_map<uint32_t, uint32_t> last_slot_;
+  // Fenwick tree over the slots, compacted when they run out
+  std::vector<uint32_t> tree_;
+  uint32_t next_slot_ = 0;
+  // hist_[d] accesses with d distinct lines since the last one to theirs
+  std::vector<uint64_t> hist_;
+  uint64_t cold_ = 0;
+
+  // set associative: stacks of line + 1, most recent first, 0 for empty
+  struct SetStacks {
+    uint32_t set_mask;
+    uint32_t depth;
+    std::vector<uint32_t> lines;
+    // hits at each stack position, the rest went past the bottom
+    std::vector<uint64_t> hits;
+    uint64_t deeper = 0;
+  };
+  std::vector<SetStacks> sets_;
+
+  uint32_t line_bits_;
+  uint64_t accesses_ = 0;
+
+  void Add(uint32_t slot, int32_t delta);
+  // marked slots up to and including `slot`
+  uint32_t Prefix(uint32_t slot) const;
+  void Compact();
+  void AccessLine(uint32_t line);
+
+ public:
+  // `line_size` is a power of 2. set associative caches are followed up to
+  // `max_size` bytes
+  StackDistance(uint32_t line_size, uint64_t max_size);
+
+  // every line the access touches counts once, as in the cache
+  void Access(uint32_t addr, uint32_t size);
+
+  uint64_t Accesses() const { return accesses_; }
+  // lines ever touched
+  uint64_t Footprint() const { return last_slot_.size(); }
+  // misses of a fully associative LRU cache of `lines` lines
+  uint64_t Misses(uint64_t lines) const;
+  // misses of an LRU cache of `sets` sets of `ways` ways. `sets` is a power
+  // of 2 and `ways` at most MAX_WAYS, within `max_size`
+  uint64_t Misses(uint64_t sets, uint32_t ways) const;
+
+  // both miss curves as text: the fully associative one at every
+  // power-of-2 size up to the footprint, the set associative one for every
+  // number of sets and ways within `max_size`
+  void Print(std::ostream& out) const;
+};
+
+#endif
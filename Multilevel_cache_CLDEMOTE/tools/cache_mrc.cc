@@ -0,0 +1,53 @@
+// LRU miss curves of an access trace recorded with --mem_trace, for every
+// cache size and associativity at one line size, in a single pass instead
+// of one replay per --cache_levels. built on its own from the simulator
+// sources it needs by the Makefile
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "access_trace.h"
+#include "options.h"
+#include "stack_distance.h"
+
+int main(int argc, char** argv) {
+  std::string trace_file;
+  uint32_t line_size = 64;
+  std::string max_size = "32M";
+
+  CLI::App app{"Cache Miss Curves"};
+  app.allow_extras(false);
+  app.add_option("-i,--input", trace_file, "Access trace from --mem_trace")
+      ->required()
+      ->check(CLI::ExistingFile);
+  app.add_option("--line_size", line_size, "Cache line size in bytes")
+      ->default_val(line_size);
+  app.add_option("--max_size", max_size,
+                 "Largest set associative cache reported, with K/M suffix")
+      ->default_val(max_size);
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+
+  try {
+    AccessTraceReader reader(trace_file);
+    StackDistance stack(line_size, Options::ParseSize(max_size));
+
+    // fetches, loads and stores all go to the one L1. demotes are hints
+    // that an LRU stack has no place for, the curves leave them out
+    AccessTraceReader::Access access;
+    while (reader.Next(access)) {
+      if (access.type != AccessTrace::DEMOTE) {
+        stack.Access(access.addr, access.size);
+      }
+    }
+    stack.Print(std::cout);
+  } catch (const std::exception& e) {
+    std::cerr << e.what();
+    return 1;
+  }
+  return 0;
+}
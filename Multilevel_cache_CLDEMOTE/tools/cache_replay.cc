@@ -0,0 +1,76 @@
+// feeds an access trace recorded with --mem_trace straight into the cache
+// hierarchy, without any pipeline. built on its own from the simulator
+// sources it needs by the Makefile
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "access_trace.h"
+#include "options.h"
+#include "trace_replay.h"
+
+int main(int argc, char** argv) {
+  Options opts;
+  Options::CacheArgs cache_args;
+  std::string trace_file;
+
+  CLI::App app{"Cache Trace Replay"};
+  app.allow_extras(false);
+  app.add_option("-i,--input", trace_file, "Access trace from --mem_trace")
+      ->required()
+      ->check(CLI::ExistingFile);
+  Options::AddCacheOptions(app, opts, cache_args);
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+  try {
+    Options::ResolveCacheOptions(opts, cache_args);
+  } catch (const std::runtime_error& e) {
+    std::cerr << "Error: " << e.what();
+    return 1;
+  }
+  if (!opts.enable_cache) {
+    std::cerr << "Error: no cache, use --cache_levels or --cache_preset\n";
+    return 1;
+  }
+
+  static constexpr const char* TYPE_NAMES[] = {"Fetches", "Loads", "Stores",
+                                               "Demotes"};
+  std::array<uint64_t, 4> counts{};
+  std::array<uint64_t, 4> latencies{};
+  try {
+    AccessTraceReader reader(trace_file);
+    TraceReplay replay(opts);
+    AccessTraceReader::Access access;
+    while (reader.Next(access)) {
+      replay.Access(access.type, access.addr, access.size);
+      counts[access.type]++;
+      latencies[access.type] += replay.Cache().GetLastAccessLatency();
+    }
+    replay.Cache().PrintStatistics();
+  } catch (const std::exception& e) {
+    std::cerr << e.what();
+    return 1;
+  }
+
+  printf("------------ ACCESS LATENCY ------------\n");
+  uint64_t count = 0;
+  uint64_t latency = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] > 0) {
+      printf("%s: %lu, %lu cycles, %.4f per access\n", TYPE_NAMES[i],
+             counts[i], latencies[i], (double)latencies[i] / counts[i]);
+    }
+    count += counts[i];
+    latency += latencies[i];
+  }
+  printf("Total: %lu, %lu cycles, %.4f per access\n", count, latency,
+         count == 0 ? 0.0 : (double)latency / count);
+  printf("----------------------------------------\n");
+  return 0;
+}
@@ -0,0 +1,222 @@
+// feeds one access trace recorded with --mem_trace into many cache
+// hierarchies at once, one per line of a configuration file, each line
+// holding cache options as cache_replay takes them, e.g.
+//   --cache_levels 32K,8,64,4,lru 256K,8,64,12,plru --inclusion_policy exclusive
+// blank lines and lines starting with # are skipped. the trace is decoded
+// once and shared, configurations are handed out to the threads one at a
+// time. built on its own from the simulator sources it needs by the
+// Makefile
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "access_trace.h"
+#include "cache.h"
+#include "options.h"
+#include "trace_replay.h"
+
+namespace {
+
+// an access of the trace as every thread replays it
+struct Record {
+  uint32_t addr;
+  AccessTrace::Type type;
+  uint8_t size;
+};
+
+struct Config {
+  // the line of the configuration file
+  std::string spec;
+  Options opts;
+};
+
+struct Result {
+  std::vector<CacheStats> stats;
+  uint64_t latency = 0;
+  std::string error;
+};
+
+std::vector<Config> ReadConfigs(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error(std::format("Cannot read {}\n", path));
+  }
+  std::vector<Config> configs;
+  std::string line;
+  for (uint32_t line_num = 1; std::getline(in, line); ++line_num) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line[start] == '#') {
+      continue;
+    }
+    Config& config = configs.emplace_back();
+    config.spec = line.substr(start);
+    Options::CacheArgs cache_args;
+    CLI::App app{"Cache Configuration"};
+    app.allow_extras(false);
+    Options::AddCacheOptions(app, config.opts, cache_args);
+    try {
+      app.parse(config.spec);
+    } catch (const CLI::ParseError& e) {
+      throw std::runtime_error(
+          std::format("{}:{}: {}\n", path, line_num, e.what()));
+    }
+    try {
+      Options::ResolveCacheOptions(config.opts, cache_args);
+    } catch (const std::runtime_error& e) {
+      throw std::runtime_error(
+          std::format("{}:{}: {}", path, line_num, e.what()));
+    }
+    if (!config.opts.enable_cache) {
+      throw std::runtime_error(std::format(
+          "{}:{}: no cache, use --cache_levels or --cache_preset\n", path,
+          line_num));
+    }
+    // every hierarchy would write the same file
+    if (config.opts.enable_trace) {
+      throw std::runtime_error(std::format(
+          "{}:{}: --enable_trace is not supported in a sweep\n", path,
+          line_num));
+    }
+  }
+  return configs;
+}
+
+std::vector<Record> Decode(const std::string& path) {
+  AccessTraceReader reader(path);
+  std::vector<Record> trace;
+  AccessTraceReader::Access access;
+  while (reader.Next(access)) {
+    trace.push_back({access.addr, access.type,
+                     static_cast<uint8_t>(access.size)});
+  }
+  return trace;
+}
+
+Result Run(const Options& opts, std::span<const Record> trace) {
+  TraceReplay replay(opts);
+  Result result;
+  for (const Record& access : trace) {
+    replay.Access(access.type, access.addr, access.size);
+    result.latency += replay.Cache().GetLastAccessLatency();
+  }
+  result.stats = replay.Cache().GetStatistics();
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string trace_file;
+  std::string config_file;
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+  CLI::App app{"Cache Configuration Sweep"};
+  app.allow_extras(false);
+  app.add_option("-i,--input", trace_file, "Access trace from --mem_trace")
+      ->required()
+      ->check(CLI::ExistingFile);
+  app.add_option("-c,--configs", config_file,
+                 "Cache options of one configuration per line")
+      ->required()
+      ->check(CLI::ExistingFile);
+  app.add_option("-j,--threads", threads, "Configurations replayed at once")
+      ->default_val(threads)
+      ->check(CLI::Range(1u, 1024u));
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+
+  std::vector<Config> configs;
+  std::vector<Record> trace;
+  try {
+    configs = ReadConfigs(config_file);
+    trace = Decode(trace_file);
+  } catch (const std::exception& e) {
+    std::cerr << e.what();
+    return 1;
+  }
+
+  // configurations differ in cost, so a thread takes the next one as soon
+  // as it is done with its last
+  std::vector<Result> results(configs.size());
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < configs.size();) {
+      try {
+        results[i] = Run(configs[i].opts, trace);
+      } catch (const std::exception& e) {
+        results[i].error = e.what();
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  threads = std::min<size_t>(threads, std::max<size_t>(configs.size(), 1));
+  for (uint32_t i = 0; i < threads; ++i) {
+    pool.emplace_back(work);
+  }
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < configs.size(); ++i) {
+    if (!results[i].error.empty()) {
+      // the messages of the cache itself end without a newline
+      std::string& error = results[i].error;
+      if (error.back() != '\n') {
+        error += '\n';
+      }
+      std::cerr << std::format("Configuration {}: {}", i, error);
+      ret = 1;
+    }
+  }
+  if (ret != 0) {
+    return ret;
+  }
+
+  size_t level_num = 0;
+  for (const Result& result : results) {
+    level_num = std::max(level_num, result.stats.size());
+  }
+  std::string line = std::format("# {} configurations, {} accesses\n",
+                                 configs.size(), trace.size());
+  line += "# id cycles_per_access";
+  for (size_t level = 1; level <= level_num; ++level) {
+    line += std::format(" L{0}_accesses L{0}_misses L{0}_hit_rate", level);
+  }
+  line += " config\n";
+  fwrite(line.data(), 1, line.size(), stdout);
+
+  for (size_t i = 0; i < configs.size(); ++i) {
+    const Result& result = results[i];
+    line = std::format("{} {:.4f}", i,
+                       trace.empty() ? 0.0
+                                     : (double)result.latency / trace.size());
+    for (size_t level = 0; level < level_num; ++level) {
+      if (level >= result.stats.size()) {
+        line += " - - -";
+        continue;
+      }
+      const CacheStats& stats = result.stats[level];
+      double hit_rate =
+          stats.accesses == 0 ? 0.0 : (double)stats.hits / stats.accesses;
+      line += std::format(" {} {} {:.4f}", stats.accesses, stats.misses,
+                          hit_rate);
+    }
+    line += std::format(" {}\n", configs[i].spec);
+    fwrite(line.data(), 1, line.size(), stdout);
+  }
+  return 0;
+}
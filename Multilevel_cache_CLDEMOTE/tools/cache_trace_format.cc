@@ -0,0 +1,41 @@
+// prints a cache trace recorded with --enable_trace as text, one event per
+// line. built on its own from the simulator sources it needs by the
+// Makefile
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include <CLI11/CLI11.hpp>
+
+#include "cache_trace.h"
+
+int main(int argc, char** argv) {
+  std::string trace_file;
+
+  CLI::App app{"Cache Trace Formatter"};
+  app.allow_extras(false);
+  app.add_option("-i,--input", trace_file, "Cache trace from --enable_trace")
+      ->required()
+      ->check(CLI::ExistingFile);
+  try {
+    app.parse(argc, argv);
+  } catch (const CLI::ParseError& e) {
+    return app.exit(e);
+  }
+
+  try {
+    CacheTraceReader reader(trace_file);
+    CacheTrace::Event event;
+    while (reader.Next(event)) {
+      std::string line = CacheTrace::Format(event);
+      line += '\n';
+      fwrite(line.data(), 1, line.size(), stdout);
+    }
+  } catch (const std::exception& e) {
+    fflush(stdout);
+    std::cerr << e.what();
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef TOOLS_TRACE_REPLAY_H
+#define TOOLS_TRACE_REPLAY_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "access_trace.h"
+#include "cache.h"
+#include "memory.h"
+#include "options.h"
+
+// a cache hierarchy fed the accesses of an access trace, without any
+// pipeline. shared by the tools replaying traces
+class TraceReplay {
+  TieredCache cache_;
+  bool timing_;
+  std::array<uint8_t, 8> data_{};
+
+ public:
+  // the whole 32-bit space the trace may address, allocated lazily
+  explicit TraceReplay(const Options& opts)
+      : cache_(opts, std::make_unique<Memory>(uint64_t(1) << 32)),
+        timing_(opts.cache_model == CacheModel::Timing) {}
+
+  // data is never looked at, stores write zeros. the timing model leaves
+  // memory alone altogether
+  void Access(AccessTrace::Type type, uint32_t addr, uint32_t size) {
+    std::span<uint8_t> bytes(data_.data(), size);
+    switch (type) {
+      case AccessTrace::FETCH:
+      case AccessTrace::LOAD:
+        if (timing_) {
+          cache_.Access(addr, size, false);
+        } else {
+          cache_.ReadSpan(addr, bytes);
+        }
+        break;
+      case AccessTrace::STORE:
+        if (timing_) {
+          cache_.Access(addr, size, true);
+        } else {
+          cache_.WriteSpan(addr, bytes);
+        }
+        break;
+      case AccessTrace::DEMOTE:
+        cache_.Demote(addr);
+        break;
+    }
+  }
+
+  TieredCache& Cache() { return cache_; }
+};
+
+#endif
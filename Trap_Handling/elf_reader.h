@@ -1,6 +1,7 @@
 #ifndef SRC_ELF_READER_H
 #define SRC_ELF_READER_H
 
+#include <algorithm>
 #include <cstdint>
 #include <elfio/elfio.hpp>
 #include <iostream>
@@ -45,13 +46,9 @@ class ElfReader {
       uint32_t memsz = pseg->get_memory_size();
       uint32_t addr = (uint32_t)pseg->get_virtual_address();
 
-      for (uint32_t p = addr; p < addr + memsz; ++p) {
-        if (p < addr + filesz) {
-          memory->SetByte(p, pseg->get_data()[p - addr]);
-        } else {
-          memory->SetByte(p, 0);
-        }
-      }
+      // memory starts zeroed, so the bss part past the file data needs no
+      // writes at all
+      memory->CopyFrom(pseg->get_data(), addr, std::min(filesz, memsz));
     }
   }
 
@@ -1,17 +1,78 @@
 #include "memory.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 
 #include "utils.h"
 
+template <typename T>
+bool Memory::Load(uint32_t addr, T &value) const {
+  uint32_t offset = addr & (PAGE_SIZE - 1);
+  if ((uint64_t)addr + sizeof(T) > memory_size_ ||
+      offset + sizeof(T) > PAGE_SIZE) {
+    return false;
+  }
+  const auto &page = pages_[addr >> PAGE_SHIFT];
+  if (page) {
+    std::memcpy(&value, page.get() + offset, sizeof(T));
+  } else {
+    value = 0;
+  }
+  return true;
+}
+
+template <typename T>
+bool Memory::Store(uint32_t addr, T value) {
+  uint32_t offset = addr & (PAGE_SIZE - 1);
+  if ((uint64_t)addr + sizeof(T) > memory_size_ ||
+      offset + sizeof(T) > PAGE_SIZE) {
+    return false;
+  }
+  std::memcpy(GetPage(addr) + offset, &value, sizeof(T));
+  return true;
+}
+
+bool Memory::CopyFrom(std::span<const uint8_t> src, uint32_t dest) {
+  if ((uint64_t)dest + src.size() > memory_size_) {
+    IFDEF(DEBUG,
+          fprintf(stderr, "Data copy to invalid addr 0x%x for len %zu!\n",
+                  dest, src.size()));
+    return false;
+  }
+  // page by page instead of byte by byte
+  while (!src.empty()) {
+    uint32_t offset = dest & (PAGE_SIZE - 1);
+    std::size_t chunk = std::min<std::size_t>(src.size(), PAGE_SIZE - offset);
+    std::memcpy(GetPage(dest) + offset, src.data(), chunk);
+    dest += chunk;
+    src = src.subspan(chunk);
+  }
+  return true;
+}
+
 bool Memory::CopyFrom(const void *src, uint32_t dest, uint32_t len) {
-  for (uint32_t i = 0; i < len; ++i) {
-    if (!AddrExist(dest + i)) {
-      IFDEF(DEBUG,
-            fprintf(stderr, "Data copy to invalid addr 0x%x!\n", dest + i));
-      return false;
+  return CopyFrom({static_cast<const uint8_t *>(src), len}, dest);
+}
+
+bool Memory::Zero(uint32_t dest, uint32_t len) {
+  if ((uint64_t)dest + len > memory_size_) {
+    IFDEF(DEBUG, fprintf(stderr, "Zeroing invalid addr 0x%x for len %u!\n",
+                         dest, len));
+    return false;
+  }
+  while (len > 0) {
+    uint32_t offset = dest & (PAGE_SIZE - 1);
+    uint32_t chunk = std::min(len, PAGE_SIZE - offset);
+    auto &page = pages_[dest >> PAGE_SHIFT];
+    if (page && chunk == PAGE_SIZE) {
+      page.reset();
+      resident_pages_--;
+    } else if (page) {
+      std::memset(page.get() + offset, 0, chunk);
     }
-    SetByte(dest + i, ((uint8_t *)src)[i]);
+    dest += chunk;
+    len -= chunk;
   }
   return true;
 }
@@ -21,7 +82,7 @@ bool Memory::SetByte(uint32_t addr, uint8_t val) {
     IFDEF(DEBUG, fprintf(stderr, "Byte write to invalid addr 0x%x!\n", addr));
     return false;
   }
-  arena_[addr] = val;
+  GetPage(addr)[addr & (PAGE_SIZE - 1)] = val;
   return true;
 }
 
@@ -30,7 +91,8 @@ uint8_t Memory::GetByte(uint32_t addr) const {
     IFDEF(DEBUG, fprintf(stderr, "Byte read to invalid addr 0x%x!\n", addr));
     return false;
   }
-  return arena_[addr];
+  const auto& page = pages_[addr >> PAGE_SHIFT];
+  return page ? page[addr & (PAGE_SIZE - 1)] : 0;
 }
 
 bool Memory::SetShort(uint32_t addr, uint16_t val) {
@@ -38,12 +100,19 @@ bool Memory::SetShort(uint32_t addr, uint16_t val) {
     IFDEF(DEBUG, fprintf(stderr, "Short write to invalid addr 0x%x!\n", addr));
     return false;
   }
+  if (Store(addr, val)) {
+    return true;
+  }
   SetByte(addr, val & 0xFF);
   SetByte(addr + 1, (val >> 8) & 0xFF);
   return true;
 }
 
 uint16_t Memory::GetShort(uint32_t addr) const {
+  uint16_t value;
+  if (Load(addr, value)) {
+    return value;
+  }
   uint32_t b1 = GetByte(addr);
   uint32_t b2 = GetByte(addr + 1);
   return b1 + (b2 << 8);
@@ -54,6 +123,9 @@ bool Memory::SetInt(uint32_t addr, uint32_t val) {
     IFDEF(DEBUG, fprintf(stderr, "Int write to invalid addr 0x%x!\n", addr));
     return false;
   }
+  if (Store(addr, val)) {
+    return true;
+  }
   SetByte(addr, val & 0xFF);
   SetByte(addr + 1, (val >> 8) & 0xFF);
   SetByte(addr + 2, (val >> 16) & 0xFF);
@@ -62,6 +134,10 @@ bool Memory::SetInt(uint32_t addr, uint32_t val) {
 }
 
 uint32_t Memory::GetInt(uint32_t addr) const {
+  uint32_t value;
+  if (Load(addr, value)) {
+    return value;
+  }
   uint32_t b1 = GetByte(addr);
   uint32_t b2 = GetByte(addr + 1);
   uint32_t b3 = GetByte(addr + 2);
@@ -74,6 +150,9 @@ bool Memory::SetLong(uint32_t addr, uint64_t val) {
     IFDEF(DEBUG, fprintf(stderr, "Long write to invalid addr 0x%x!\n", addr));
     return false;
   }
+  if (Store(addr, val)) {
+    return true;
+  }
   SetByte(addr, val & 0xFF);
   SetByte(addr + 1, (val >> 8) & 0xFF);
   SetByte(addr + 2, (val >> 16) & 0xFF);
@@ -86,6 +165,10 @@ bool Memory::SetLong(uint32_t addr, uint64_t val) {
 }
 
 uint64_t Memory::GetLong(uint32_t addr) const {
+  uint64_t value;
+  if (Load(addr, value)) {
+    return value;
+  }
   uint64_t b1 = GetByte(addr);
   uint64_t b2 = GetByte(addr + 1);
   uint64_t b3 = GetByte(addr + 2);
@@ -98,7 +181,16 @@ uint64_t Memory::GetLong(uint32_t addr) const {
          (b7 << 48) + (b8 << 56);
 }
 
+uint8_t *Memory::GetPage(uint32_t addr) {
+  auto &page = pages_[addr >> PAGE_SHIFT];
+  if (!page) {
+    page = std::make_unique<uint8_t[]>(PAGE_SIZE);
+    resident_pages_++;
+  }
+  return page.get();
+}
+
 bool Memory::AddrExist(uint32_t addr) const {
-  if ((uint64_t)addr >= arena_.size()) return false;
+  if ((uint64_t)addr >= memory_size_) return false;
   return true;
 }
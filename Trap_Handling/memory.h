@@ -2,17 +2,39 @@
 #define SRC_MEMORY_MANAGER_H
 
 #include <elfio/elfio.hpp>
+#include <memory>
+#include <span>
 #include <vector>
 
+// sparse memory, pages are allocated on first write and untouched pages
+// read as zero
 class Memory {
-  std::vector<uint8_t> arena_{};
+  static constexpr uint32_t PAGE_SHIFT = 12;
+  static constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+
+  std::vector<std::unique_ptr<uint8_t[]>> pages_{};
+  uint64_t memory_size_ = 0;
+  uint64_t resident_pages_ = 0;
   bool AddrExist(uint32_t addr) const;
+  // page holding `addr`, allocated if never written
+  uint8_t *GetPage(uint32_t addr);
+  // full-width access, false if [addr, addr + sizeof(T)) is not within a
+  // single page of memory and has to be done byte by byte
+  template <typename T>
+  bool Load(uint32_t addr, T &value) const;
+  template <typename T>
+  bool Store(uint32_t addr, T value);
 
  public:
-  explicit Memory(uint64_t memory_size) { arena_.resize(memory_size, 0); };
+  explicit Memory(uint64_t memory_size)
+      : pages_((memory_size + PAGE_SIZE - 1) >> PAGE_SHIFT),
+        memory_size_(memory_size){};
   ~Memory() = default;
 
+  bool CopyFrom(std::span<const uint8_t> src, uint32_t dest);
   bool CopyFrom(const void *src, uint32_t dest, uint32_t len);
+  // clear [dest, dest + len), pages wholly inside are released
+  bool Zero(uint32_t dest, uint32_t len);
 
   bool SetByte(uint32_t addr, uint8_t val);
   uint8_t GetByte(uint32_t addr) const;
@@ -25,6 +47,9 @@ class Memory {
 
   bool SetLong(uint32_t addr, uint64_t val);
   uint64_t GetLong(uint32_t addr) const;
+
+  // bytes of the pages allocated so far
+  uint64_t ResidentSize() const { return resident_pages_ << PAGE_SHIFT; }
 };
 
 #endif
\ No newline at end of file
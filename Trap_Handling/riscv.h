@@ -187,6 +187,16 @@ inline bool IsReadMem(InstType instType) {
          instType == LBU || instType == LHU || instType == LWU;
 }
 
+// register-independent part of a decoded instruction,
+// cached per pc so that loops skip the opcode switch
+struct DecodedInst {
+  InstType inst_type = UNKNOWN;
+  int8_t rs1 = -1, rs2 = -1, dest_reg = -1;
+  // op1 if there is no rs1, otherwise op2 if there is no rs2
+  int32_t imm = 0;
+  int32_t offset = 0;
+};
+
 struct PipeOp {
   // fetch
   uint64_t pc = 0;
@@ -199,8 +209,6 @@ struct PipeOp {
   int64_t op1 = 0, op2 = 0;
   RegId dest_reg = -1;
   int64_t offset = 0;
-  // internal decode result
-  std::string inst_str;
 
   // execute
   int64_t out = 0;
@@ -213,7 +221,10 @@ struct PipeOp {
 };
 
 // simulator-irrelavant decoder and executor
-void DecodeInst(PipeOp* op, const Regs& regs);
+DecodedInst PredecodeInst(uint32_t inst);
+void DecodeInst(PipeOp* op, const DecodedInst& decoded, const Regs& regs);
+std::string DisassembleInst(const DecodedInst& decoded);
+std::string DisassembleInst(uint32_t inst);
 void ExecuteInst(PipeOp* op, bool* exit_ctrl, const Memory* mem);
 }  // namespace RISCV
 